@@ -34,6 +34,9 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <xtensa/hal.h>
+#include <xtensa/config/core.h>
+
+#define DCACHE_LINE_SIZE	XCHAL_DCACHE_LINESIZE
 
 #if defined CONFIG_BAYTRAIL || defined CONFIG_CHERRYTRAIL
 
@@ -34,6 +34,7 @@
 
 #include <xtensa/xtruntime.h>
 #include <xtensa/hal.h>
+#include <xtensa/corebits.h>
 #include <reef/interrupt-map.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -83,6 +84,23 @@ static inline uint32_t arch_interrupt_get_status(void)
 	return xthal_get_interrupt();
 }
 
+/* returns current core interrupt level */
+static inline uint32_t arch_interrupt_get_level(void)
+{
+	uint32_t ps;
+
+	asm volatile("rsr	%0, ps"
+		     : "=a" (ps));
+	return ps & PS_INTLEVEL_MASK;
+}
+
+/* returns interrupt level of irq */
+static inline uint32_t arch_interrupt_get_irq_level(int irq)
+{
+	irq = REEF_IRQ_NUMBER(irq);
+	return Xthal_intlevel[irq];
+}
+
 static inline uint32_t arch_interrupt_global_disable(void)
 {
 	uint32_t flags;
@@ -40,4 +40,8 @@ void *xthal_memcpy(void *dst, const void *src, size_t len);
 #define arch_memcpy(dest, src, size) \
 	xthal_memcpy(dest, src, size)
 
+/* wait for all outstanding loads and stores to complete */
+#define arch_memory_barrier() \
+	__asm__ __volatile__("memw" : : : "memory")
+
 #endif
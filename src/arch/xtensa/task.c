@@ -33,12 +33,14 @@
 #include <reef/interrupt.h>
 #include <platform/platform.h>
 #include <reef/debug.h>
+#include <reef/cpu.h>
 #include <stdint.h>
 #include <errno.h>
 
-static struct task *_irq_low_task = NULL;
-static struct task *_irq_med_task = NULL;
-static struct task *_irq_high_task = NULL;
+/* task IRQs are core local so each core has its own running tasks */
+static struct task *_irq_low_task[PLATFORM_CORE_COUNT];
+static struct task *_irq_med_task[PLATFORM_CORE_COUNT];
+static struct task *_irq_high_task[PLATFORM_CORE_COUNT];
 
 static inline uint32_t task_get_irq(struct task *task)
 {
@@ -64,14 +66,14 @@ static inline void task_set_data(struct task *task)
 {
 	switch (task->priority) {
 	case TASK_PRI_MED + 1 ... TASK_PRI_LOW:
-		_irq_low_task = task;
+		_irq_low_task[task->core] = task;
 		break;
 	case TASK_PRI_HIGH ... TASK_PRI_MED - 1:
-		_irq_high_task = task;
+		_irq_high_task[task->core] = task;
 		break;
 	case TASK_PRI_MED:
 	default:
-		_irq_med_task = task;
+		_irq_med_task[task->core] = task;
 		break;
 	}
 }
@@ -81,12 +83,16 @@ static void _irq_low(void *arg)
 	struct task *task = *(struct task **)arg;
 	uint32_t irq;
 
+	schedule_task_running(task);
+
 	if (task->func)
 		task->func(task->data);
 
-	schedule_task_complete(task);
+	/* clear before completion as the scheduler may run the next task
+	 * at this priority and set the IRQ again */
 	irq = task_get_irq(task);
 	interrupt_clear(irq);
+	schedule_task_complete(task);
 }
 
 static void _irq_med(void *arg)
@@ -94,12 +100,16 @@ static void _irq_med(void *arg)
 	struct task *task = *(struct task **)arg;
 	uint32_t irq;
 
+	schedule_task_running(task);
+
 	if (task->func)
 		task->func(task->data);
 
-	schedule_task_complete(task);
+	/* clear before completion as the scheduler may run the next task
+	 * at this priority and set the IRQ again */
 	irq = task_get_irq(task);
 	interrupt_clear(irq);
+	schedule_task_complete(task);
 }
 
 static void _irq_high(void *arg)
@@ -107,12 +117,16 @@ static void _irq_high(void *arg)
 	struct task *task = *(struct task **)arg;
 	uint32_t irq;
 
+	schedule_task_running(task);
+
 	if (task->func)
 		task->func(task->data);
 
-	schedule_task_complete(task);
+	/* clear before completion as the scheduler may run the next task
+	 * at this priority and set the IRQ again */
 	irq = task_get_irq(task);
 	interrupt_clear(irq);
+	schedule_task_complete(task);
 }
 
 /* architecture specific method of running task */
@@ -125,15 +139,21 @@ void arch_run_task(struct task *task)
 	interrupt_set(irq);
 }
 
+/* called on each core that runs tasks */
 int arch_init_tasks(void)
 {
-	interrupt_register(PLATFORM_IRQ_TASK_LOW, _irq_low, &_irq_low_task);
+	int core = cpu_get_id();
+
+	interrupt_register(PLATFORM_IRQ_TASK_LOW, _irq_low,
+		&_irq_low_task[core]);
 	interrupt_enable(PLATFORM_IRQ_TASK_LOW);
 
-	interrupt_register(PLATFORM_IRQ_TASK_MED, _irq_med, &_irq_med_task);
+	interrupt_register(PLATFORM_IRQ_TASK_MED, _irq_med,
+		&_irq_med_task[core]);
 	interrupt_enable(PLATFORM_IRQ_TASK_MED);
 
-	interrupt_register(PLATFORM_IRQ_TASK_HIGH, _irq_high, &_irq_high_task);
+	interrupt_register(PLATFORM_IRQ_TASK_HIGH, _irq_high,
+		&_irq_high_task[core]);
 	interrupt_enable(PLATFORM_IRQ_TASK_HIGH);
 
 	return 0;
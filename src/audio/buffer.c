@@ -59,16 +59,17 @@ struct comp_buffer *buffer_new(struct sof_ipc_buffer *desc)
 		return NULL;
 	}
 
-	/* allocate new buffer */
-	buffer = rzalloc(RZONE_RUNTIME, RFLAGS_NONE, sizeof(*buffer));
+	/* allocate new buffer, cache line aligned for its position lines */
+	buffer = rballoc(RZONE_RUNTIME, RFLAGS_NONE, sizeof(*buffer));
 	if (buffer == NULL) {
 		trace_buffer_error("ebN");
 		return NULL;
 	}
+	bzero(buffer, sizeof(*buffer));
 
 	buffer->addr = rballoc(RZONE_RUNTIME, RFLAGS_NONE, desc->size);
 	if (buffer->addr == NULL) {
-		rfree(buffer);
+		rbfree(buffer);
 		trace_buffer_error("ebm");
 		return NULL;
 	}
@@ -80,9 +81,11 @@ struct comp_buffer *buffer_new(struct sof_ipc_buffer *desc)
 	buffer->ipc_buffer = *desc;
 	buffer->w_ptr = buffer->r_ptr = buffer->addr;
 	buffer->end_addr = buffer->addr + buffer->ipc_buffer.size;
-	buffer->free = buffer->ipc_buffer.size;
-	buffer->avail = 0;
+	buffer->w_count = buffer->r_count = buffer->wb_count = 0;
 	buffer->connected = 0;
+	buffer->cross_core = 0;
+	buffer->inplace = NULL;
+	buffer->release = buffer;
 
 	return buffer;
 }
@@ -94,6 +97,9 @@ void buffer_free(struct comp_buffer *buffer)
 
 	list_item_del(&buffer->source_list);
 	list_item_del(&buffer->sink_list);
-	rfree(buffer->addr);
-	rfree(buffer);
+
+	/* in place buffers use memory owned by another buffer */
+	if (buffer->inplace == NULL)
+		rbfree(buffer->addr);
+	rbfree(buffer);
 }
@@ -102,8 +102,8 @@ static void dai_dma_cb(void *data, uint32_t type, struct dma_sg_elem *next)
 		/* recalc available buffer space */
 		comp_update_buffer_consume(dma_buffer, copied_size);
 
-		/* writeback buffer contents from cache */
-		dcache_writeback_region(dma_buffer->r_ptr, copied_size);
+		/* writeback new buffer contents from cache */
+		comp_buffer_writeback(dma_buffer);
 
 		/* update host position(in bytes offset) for drivers */
 		dev->position += copied_size;
@@ -118,7 +118,7 @@ static void dai_dma_cb(void *data, uint32_t type, struct dma_sg_elem *next)
 			struct comp_buffer, source_list);
 
 		/* invalidate buffer contents */
-		dcache_invalidate_region(dma_buffer->w_ptr, dd->period_bytes);
+		comp_buffer_invalidate(dma_buffer, dd->period_bytes);
 
 		/* recalc available buffer space */
 		comp_update_buffer_produce(dma_buffer, dd->period_bytes);
@@ -404,7 +404,7 @@ static int dai_prepare(struct comp_dev *dev)
 		dma_buffer = list_first_item(&dev->bsource_list,
 			struct comp_buffer, sink_list);
 
-		dcache_writeback_region(dma_buffer->r_ptr, dma_buffer->avail);
+		comp_buffer_writeback(dma_buffer);
 	}
 
 	ret = dma_set_config(dd->dma, dd->chan, &dd->config);
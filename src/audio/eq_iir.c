@@ -74,52 +74,40 @@ static void eq_iir_s32_default(struct comp_dev *dev,
 	struct comp_buffer *source, struct comp_buffer *sink, uint32_t frames)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
-	int ch, n, n_wrap_src, n_wrap_snk, n_wrap_min;
 	int32_t *src = (int32_t *) source->r_ptr;
 	int32_t *snk = (int32_t *) sink->w_ptr;
+	int32_t *x, *y;
 	int nch = dev->params.channels;
-	int32_t *x = src + nch - 1;
-	int32_t *y = snk + nch - 1;
-
-	for (ch = 0; ch < nch; ch++) {
-		n = frames * nch;
-		x = src++;
-		y = snk++;
-		while (n > 0) {
-			n_wrap_src = (int32_t *) source->end_addr - x;
-			n_wrap_snk = (int32_t *) sink->end_addr - y;
-			n_wrap_min = (n_wrap_src < n_wrap_snk) ?
-				n_wrap_src : n_wrap_snk;
-			if (n < n_wrap_min) {
-				/* No circular wrap need */
-				while (n > 0) {
-					*y = iir_df2t(&cd->iir[ch], *x);
-					x += nch;
-					y += nch;
-					n -= nch;
-				}
-			} else {
-				/* Wrap in n_wrap_min/nch samples */
-				while (n_wrap_min > 0) {
-					*y = iir_df2t(&cd->iir[ch], *x);
-					x += nch;
-					y += nch;
-					n_wrap_min -= nch;
-					n -= nch;
-				}
-				/* Check both source and destination for wrap */
-				if (x > (int32_t *) source->end_addr)
-					x = (int32_t *)
-					((size_t) x - source->size);
-				if (snk > (int32_t *) sink->end_addr)
-					y = (int32_t *)
-					((size_t) y - sink->size);
+	uint32_t frame_bytes = nch * sizeof(int32_t);
+	uint32_t i, n;
+	int ch;
+
+	while (frames > 0) {
+		/* process linear frames up to the first buffer wrap */
+		n = buffer_linear_frames(source, src, frame_bytes);
+		if (n > buffer_linear_frames(sink, snk, frame_bytes))
+			n = buffer_linear_frames(sink, snk, frame_bytes);
+		if (n > frames)
+			n = frames;
+		if (n == 0) {
+			trace_eq_iir_error("eLf");
+			return;
+		}
+
+		for (ch = 0; ch < nch; ch++) {
+			x = src + ch;
+			y = snk + ch;
+			for (i = 0; i < n; i++) {
+				*y = iir_df2t(&cd->iir[ch], *x);
+				x += nch;
+				y += nch;
 			}
 		}
 
+		src = buffer_wrap_ptr(source, src + n * nch);
+		snk = buffer_wrap_ptr(sink, snk + n * nch);
+		frames -= n;
 	}
-	source->r_ptr = x - nch + 1; /* After previous loop the x and y */
-	sink->w_ptr = y - nch + 1; /*  point to one frame -1. */
 }
 
 static void eq_iir_free_parameters(struct eq_iir_configuration **config)
@@ -291,7 +279,7 @@ static int eq_iir_params(struct comp_dev *dev)
 	struct comp_data *cd = comp_get_drvdata(dev);
 	struct sof_ipc_comp_config *config = COMP_GET_CONFIG(dev);
 	struct comp_buffer *sink;
-	int err;
+	int err, i, macs;
 
 	trace_eq_iir("par");
 
@@ -312,6 +300,14 @@ static int eq_iir_params(struct comp_dev *dev)
 	if (config->frame_fmt != SOF_IPC_FRAME_S32_LE)
 		return -EINVAL;
 
+	/* five coefficient and one gain MAC per biquad, bypassed channels are
+	 * a copy */
+	dev->cycles = 0;
+	for (i = 0; i < dev->params.channels && i < PLATFORM_MAX_CHANNELS; i++) {
+		macs = cd->iir[i].biquads > 0 ? cd->iir[i].biquads * 6 : 1;
+		dev->cycles += macs * PLATFORM_MAC_COST;
+	}
+
 	return 0;
 }
 
@@ -437,8 +433,8 @@ static int eq_iir_copy(struct comp_dev *dev)
 	cd->eq_iir_func(dev, source, sink, dev->frames);
 
 	/* calc new free and available */
-	comp_update_buffer_consume(source, copy_bytes);
-	comp_update_buffer_produce(sink, copy_bytes);
+	comp_update_buffer_consume(source, cd->period_bytes);
+	comp_update_buffer_produce(sink, cd->period_bytes);
 
 	return dev->frames;
 }
@@ -446,6 +442,8 @@ static int eq_iir_copy(struct comp_dev *dev)
 static int eq_iir_prepare(struct comp_dev *dev)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
+	struct comp_buffer *source, *sink;
+	uint32_t frame_bytes;
 	int ret;
 
 	trace_eq_iir("EPp");
@@ -463,6 +461,18 @@ static int eq_iir_prepare(struct comp_dev *dev)
 	if (ret < 0)
 		return ret;
 
+	/* frames must never be split by either buffer wrap */
+	frame_bytes = dev->params.channels * sizeof(int32_t);
+	source = list_first_item(&dev->bsource_list, struct comp_buffer,
+		sink_list);
+	sink = list_first_item(&dev->bsink_list, struct comp_buffer,
+		source_list);
+	if (!buffer_frames_aligned(source, frame_bytes) ||
+		!buffer_frames_aligned(sink, frame_bytes)) {
+		trace_eq_iir_error("eFa");
+		return -EINVAL;
+	}
+
 	//dev->preload = PLAT_INT_PERIODS;
 	dev->state = COMP_STATE_PREPARE;
 	return 0;
@@ -493,6 +503,7 @@ static int eq_iir_reset(struct comp_dev *dev)
 
 struct comp_driver comp_eq_iir = {
 	.type = SOF_COMP_EQ_IIR,
+	.inplace = 1,
 	.ops = {
 		.new = eq_iir_new,
 		.free = eq_iir_free,
@@ -128,7 +128,7 @@ static void host_dma_cb(void *data, uint32_t type, struct dma_sg_elem *next)
 	if (dev->params.direction == SOF_IPC_STREAM_PLAYBACK) {
 
 		/* invalidate audio data */
-		dcache_invalidate_region(dma_buffer->w_ptr, local_elem->size);
+		comp_buffer_invalidate(dma_buffer, local_elem->size);
 
 		/* recalc available buffer space */
 		comp_update_buffer_produce(hd->dma_buffer, local_elem->size);
@@ -137,8 +137,8 @@ static void host_dma_cb(void *data, uint32_t type, struct dma_sg_elem *next)
 		/* recalc available buffer space */
 		comp_update_buffer_consume(hd->dma_buffer, local_elem->size);
 
-		/* writeback audio data */
-		dcache_writeback_region(dma_buffer->r_ptr, local_elem->size);
+		/* writeback new audio data */
+		comp_buffer_writeback(dma_buffer);
 	}
 
 	/* new local period, update host buffer position blks */
@@ -455,7 +455,7 @@ static int host_preload(struct comp_dev *dev)
 	/* make sure there is enough space in sink buffer */
 	sink = list_first_item(&dev->bsink_list, struct comp_buffer,
 		source_list);
-	if (sink->free < hd->period_bytes)
+	if (comp_buffer_get_free(sink) < hd->period_bytes)
 		return 0;
 
 	wait_init(&hd->complete);
@@ -635,12 +635,12 @@ static int host_copy(struct comp_dev *dev)
 	if (dev->params.direction == SOF_IPC_STREAM_PLAYBACK) {
 		dma_buffer = list_first_item(&dev->bsink_list,
 			struct comp_buffer, source_list);
-		if (dma_buffer->free < local_elem->size)
+		if (comp_buffer_get_free(dma_buffer) < local_elem->size)
 			return 0;
 	} else {
 		dma_buffer = list_first_item(&dev->bsource_list,
 			struct comp_buffer, sink_list);
-		if (dma_buffer->avail < local_elem->size)
+		if (comp_buffer_get_avail(dma_buffer) < local_elem->size)
 			return 0;
 	}
 
@@ -119,6 +119,8 @@ static int mixer_params(struct comp_dev *dev)
 	struct mixer_data *md = comp_get_drvdata(dev);
 	struct sof_ipc_comp_config *config = COMP_GET_CONFIG(dev);
 	struct comp_buffer *sink;
+	struct list_item *blist;
+	int sources = 0;
 	int ret;
 
 	trace_mixer("par");
@@ -148,6 +150,11 @@ static int mixer_params(struct comp_dev *dev)
 
 	buffer_reset_pos(sink);
 
+	/* one accumulate per sample of each source */
+	list_for_item(blist, &dev->bsource_list)
+		sources++;
+	dev->cycles = sources * dev->params.channels * PLATFORM_MAC_COST;
+
 	return 0;
 }
 
@@ -216,6 +223,7 @@ static int mixer_copy(struct comp_dev *dev)
 	struct comp_buffer *sink, *sources[PLATFORM_MAX_STREAMS], *source;
 	struct list_item *blist;
 	int32_t i = 0, num_mix_sources = 0, xru = 0;
+	uint32_t avail, free;
 
 	tracev_mixer("cpy");
 
@@ -234,9 +242,9 @@ static int mixer_copy(struct comp_dev *dev)
 
 	/* make sure no sources have underruns */
 	for (i = 0; i < num_mix_sources; i++) {
-		if (sources[i]->avail < md->period_bytes) {
-			comp_underrun(dev, sources[i], sources[i]->avail,
-				md->period_bytes);
+		avail = comp_buffer_get_avail(sources[i]);
+		if (avail < md->period_bytes) {
+			comp_underrun(dev, sources[i], avail, md->period_bytes);
 			xru = 1;
 		}
 	}
@@ -246,8 +254,9 @@ static int mixer_copy(struct comp_dev *dev)
 
 	/* make sure sink has no overuns */
 	sink = list_first_item(&dev->bsink_list, struct comp_buffer, source_list);
-	if (sink->free < md->period_bytes) {
-		comp_overrun(dev, sink, sink->free, md->period_bytes);
+	free = comp_buffer_get_free(sink);
+	if (free < md->period_bytes) {
+		comp_overrun(dev, sink, free, md->period_bytes);
 		return 0;
 	}
 
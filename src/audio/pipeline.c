@@ -55,10 +55,28 @@ struct op_data {
 	struct stream_params *params;
 	int cmd;
 	void *cmd_data;
+	uint32_t kcps;		/* estimated pipeline load for params */
 };
 
 static struct pipeline_data *pipe_data;
 static void pipeline_task(void *arg);
+static int copy_list_build(struct pipeline *p, int all);
+
+/* check if buffer to another pipeline is shared with another core */
+static void connect_core(struct pipeline *p, struct comp_buffer *buffer,
+	struct comp_dev *other)
+{
+	/* other pipeline checks this buffer when it's completed */
+	if (other->pipeline == NULL)
+		return;
+
+	if (other->pipeline->pipe_task.core == p->pipe_task.core)
+		return;
+
+	buffer->cross_core = 1;
+	other->pipeline->cross_core = 1;
+	p->cross_core = 1;
+}
 
 /* call op on all upstream components - locks held by caller */
 static void connect_upstream(struct pipeline *p, struct comp_dev *start,
@@ -85,8 +103,10 @@ static void connect_upstream(struct pipeline *p, struct comp_dev *start,
 		buffer = container_of(clist, struct comp_buffer, sink_list);
 
 		/* dont go upstream if this source is from another pipeline */
-		if (buffer->source->comp.pipeline_id != p->ipc_pipe.pipeline_id)
+		if (buffer->source->comp.pipeline_id != p->ipc_pipe.pipeline_id) {
+			connect_core(p, buffer, buffer->source);
 			continue;
+		}
 
 		connect_upstream(p, start, buffer->source);
 	}
@@ -117,8 +137,10 @@ static void connect_downstream(struct pipeline *p, struct comp_dev *start,
 		buffer = container_of(clist, struct comp_buffer, source_list);
 
 		/* dont go downstream if this sink is from another pipeline */
-		if (buffer->sink->comp.pipeline_id != p->ipc_pipe.pipeline_id)
+		if (buffer->sink->comp.pipeline_id != p->ipc_pipe.pipeline_id) {
+			connect_core(p, buffer, buffer->sink);
 			continue;
+		}
 
 		connect_downstream(p, start, buffer->sink);
 	}
@@ -187,6 +209,9 @@ static void disconnect_downstream(struct pipeline *p, struct comp_dev *start,
 static void pipeline_cmd_update(struct pipeline *p, struct comp_dev *comp,
 	int cmd)
 {
+	/* component state may have changed so rebuild copy schedule */
+	p->copy_dirty = 1;
+
 	if (p->sched_comp != comp)
 		return;
 
@@ -199,9 +224,11 @@ static void pipeline_cmd_update(struct pipeline *p, struct comp_dev *comp,
 	case COMP_CMD_RELEASE:
 		p->xrun_bytes = 0;
 
-		/* schedule pipeline */
+		/* timer driven pipelines are periodic */
 		if (p->ipc_pipe.timer)
-			pipeline_schedule_copy(p, 0);
+			schedule_task_periodic(&p->pipe_task,
+				p->ipc_pipe.deadline, p->ipc_pipe.deadline,
+				TASK_LATE_CATCHUP);
 
 		break;
 	case COMP_CMD_SUSPEND:
@@ -211,21 +238,76 @@ static void pipeline_cmd_update(struct pipeline *p, struct comp_dev *comp,
 	}
 }
 
+/* estimated component load in kcps for current params */
+static inline uint32_t comp_load(struct comp_dev *dev)
+{
+	return (uint64_t)dev->cycles * dev->params.rate / 1000;
+}
+
+/* load in kcps declared by topology as worst case instructions per period */
+static inline uint32_t pipeline_mips_load(struct sof_ipc_pipe_new *pipe_desc)
+{
+	if (pipe_desc->deadline == 0)
+		return 0;
+
+	return (uint64_t)pipe_desc->mips * 1000 / pipe_desc->deadline;
+}
+
+/*
+ * Reserve core load for the pipeline. The larger of the declared and the
+ * estimated component load is used, and a pipeline with several hosts keeps
+ * the largest reservation until it's reset.
+ */
+static int pipeline_load_reserve(struct pipeline *p, uint32_t kcps)
+{
+	uint32_t mips_kcps = pipeline_mips_load(&p->ipc_pipe);
+	int ret;
+
+	if (mips_kcps > kcps)
+		kcps = mips_kcps;
+
+	if (kcps <= p->kcps)
+		return 0;
+
+	ret = schedule_load_update(p->pipe_task.core, p->kcps, kcps);
+	if (ret < 0) {
+		trace_pipe_error("ePL");
+		trace_value(kcps);
+		return ret;
+	}
+
+	p->kcps = kcps;
+	return 0;
+}
+
+static void pipeline_load_release(struct pipeline *p)
+{
+	schedule_load_update(p->pipe_task.core, p->kcps, 0);
+	p->kcps = 0;
+}
+
 /* create new pipeline - returns pipeline id or negative error */
 struct pipeline *pipeline_new(struct sof_ipc_pipe_new *pipe_desc,
 	struct comp_dev *cd)
 {
 	struct pipeline *p;
+	struct mm_arena *arena, *prev;
 
 	trace_pipe("new");
 
-	/* allocate new pipeline */
+	/* allocate new pipeline from its arena */
+	arena = arena_get(pipe_desc->pipeline_id);
+	prev = arena_select(arena);
 	p = rzalloc(RZONE_RUNTIME, RFLAGS_NONE, sizeof(*p));
+	arena_select(prev);
 	if (p == NULL) {
 		trace_pipe_error("ePN");
+		arena_put(arena);
 		return NULL;
 	}
 
+	p->arena = arena;
+
 	/* init pipeline */
 	p->sched_comp = cd;
 	schedule_task_init(&p->pipe_task, pipeline_task, p);
@@ -236,12 +318,21 @@ struct pipeline *pipeline_new(struct sof_ipc_pipe_new *pipe_desc,
 	spinlock_init(&p->lock);
 	memcpy(&p->ipc_pipe, pipe_desc, sizeof(*pipe_desc));
 
+	/* warn early if the core can't run this pipeline, it's rejected at
+	 * params time if it still doesn't fit */
+	if (pipeline_mips_load(pipe_desc) > schedule_load_free(pipe_desc->core)) {
+		trace_pipe_error("wPL");
+		trace_value(pipe_desc->mips);
+	}
+
 	return p;
 }
 
 /* pipelines must be inactive */
 int pipeline_free(struct pipeline *p)
 {
+	struct mm_arena *arena = p->arena;
+
 	trace_pipe("fre");
 
 	/* make sure we are not in use */
@@ -252,14 +343,19 @@ int pipeline_free(struct pipeline *p)
 
 	/* remove from any scheduling */
 	schedule_task_free(&p->pipe_task);
+	pipeline_load_release(p);
 
 	/* disconnect components */
 	disconnect_downstream(p, p->sched_comp, p->sched_comp);
 	disconnect_upstream(p, p->sched_comp, p->sched_comp);
 
 	/* now free the pipeline */
+	rfree(p->copy_list);
 	rfree(p);
 
+	/* release arena, freed once its components and buffers are freed */
+	arena_put(arena);
+
 	return 0;
 }
 
@@ -273,6 +369,10 @@ void pipeline_complete(struct pipeline *p)
 
 	connect_downstream(p, p->sched_comp, p->sched_comp);
 	connect_upstream(p, p->sched_comp, p->sched_comp);
+
+	/* size the copy schedule now, it's built when components are active */
+	copy_list_build(p, 1);
+	p->copy_dirty = 1;
 }
 
 /* connect component -> buffer */
@@ -291,6 +391,10 @@ int pipeline_comp_connect(struct pipeline *p, struct comp_dev *source_comp,
 	if (sink_buffer->source && sink_buffer->sink)
 		sink_buffer->connected = 1;
 
+	/* graph has changed so rebuild copy schedule */
+	if (source_comp->pipeline)
+		source_comp->pipeline->copy_dirty = 1;
+
 	tracev_value((source_comp->comp.id << 16) |
 		sink_buffer->ipc_buffer.comp.id);
 	return 0;
@@ -312,11 +416,177 @@ int pipeline_buffer_connect(struct pipeline *p,
 	if (source_buffer->source && source_buffer->sink)
 		source_buffer->connected = 1;
 
+	/* graph has changed so rebuild copy schedule */
+	if (sink_comp->pipeline)
+		sink_comp->pipeline->copy_dirty = 1;
+
 	tracev_value((source_buffer->ipc_buffer.comp.id << 16) |
 		sink_comp->comp.id);
 	return 0;
 }
 
+/* get the PCM frame format of data written by a component */
+static uint32_t comp_frame_fmt(struct comp_dev *dev)
+{
+	struct sof_ipc_comp_config *config = COMP_GET_CONFIG(dev);
+
+	switch (dev->comp.type) {
+	case SOF_COMP_HOST:
+	case SOF_COMP_SG_HOST:
+		/* host format comes from IPC params */
+		return dev->params.frame_fmt;
+	default:
+		/* others come from comp config */
+		return config->frame_fmt;
+	}
+}
+
+/* set the last consumer of all in place buffers up to and including buffer */
+static void inplace_set_release(struct comp_buffer *buffer,
+	struct comp_buffer *release)
+{
+	for (;;) {
+		buffer->release = release;
+		if (buffer->inplace == NULL)
+			return;
+
+		/* previous buffer is the source of the in place component */
+		buffer = list_first_item(&buffer->source->bsource_list,
+			struct comp_buffer, sink_list);
+	}
+}
+
+/* can component process data from source to sink buffer in place ? */
+static int inplace_valid(struct comp_dev *dev, struct comp_buffer *source,
+	struct comp_buffer *sink)
+{
+	struct sof_ipc_comp_config *config = COMP_GET_CONFIG(dev);
+	struct sof_ipc_comp_config *source_config;
+	struct comp_buffer *owner = source->inplace ? source->inplace : source;
+
+	if (!dev->drv->inplace)
+		return 0;
+
+	/* only components with 1 source and 1 sink */
+	if (!list_item_is_last(&source->sink_list, &dev->bsource_list) ||
+		!list_item_is_last(&sink->source_list, &dev->bsink_list))
+		return 0;
+
+	/* DMA filled buffers are only invalidated, never written by the CPU */
+	switch (owner->source->comp.type) {
+	case SOF_COMP_HOST:
+	case SOF_COMP_SG_HOST:
+	case SOF_COMP_DAI:
+	case SOF_COMP_SG_DAI:
+		return 0;
+	default:
+		break;
+	}
+
+	/* all in this pipeline on the same core */
+	if (source->source->pipeline != dev->pipeline ||
+		sink->sink->pipeline != dev->pipeline ||
+		source->cross_core || sink->cross_core)
+		return 0;
+
+	/* same format and ring size on both sides */
+	source_config = COMP_GET_CONFIG(source->source);
+	if (comp_frame_fmt(source->source) != config->frame_fmt ||
+		comp_frame_fmt(sink->sink) != config->frame_fmt ||
+		source_config->periods_sink != config->periods_sink)
+		return 0;
+
+	/* both rings must wrap at the same point or data is corrupted */
+	if (sink->size != owner->size ||
+		owner->addr + sink->size != owner->end_addr)
+		return 0;
+
+	return sink->ipc_buffer.size <= owner->alloc_size;
+}
+
+/* process component in place - sink buffer uses source buffer memory */
+static void inplace_link(struct comp_buffer *source, struct comp_buffer *sink)
+{
+	struct comp_buffer *owner = source->inplace ? source->inplace : source;
+
+	rbfree(sink->addr);
+
+	sink->inplace = owner;
+	sink->addr = owner->addr;
+	sink->alloc_size = owner->alloc_size;
+	sink->end_addr = sink->addr + sink->size;
+	buffer_reset_pos(sink);
+
+	/* memory is now released when sink is consumed */
+	inplace_set_release(sink, sink);
+}
+
+/* give in place sink buffer its own memory again */
+static int inplace_unlink(struct comp_buffer *sink)
+{
+	struct comp_buffer *source;
+	void *addr;
+
+	if (sink->inplace == NULL)
+		return 0;
+
+	addr = rballoc(RZONE_RUNTIME, RFLAGS_NONE, sink->ipc_buffer.size);
+	if (addr == NULL) {
+		trace_pipe_error("eIu");
+		trace_value(sink->ipc_buffer.comp.id);
+		return -ENOMEM;
+	}
+	bzero(addr, sink->ipc_buffer.size);
+
+	/* source memory is now released when source is consumed */
+	source = list_first_item(&sink->source->bsource_list,
+		struct comp_buffer, sink_list);
+	inplace_set_release(source, source);
+
+	sink->inplace = NULL;
+	sink->release = sink;
+	sink->addr = addr;
+	sink->alloc_size = sink->ipc_buffer.size;
+	if (sink->size > sink->alloc_size)
+		sink->size = sink->alloc_size;
+	sink->end_addr = sink->addr + sink->size;
+	buffer_reset_pos(sink);
+
+	return 0;
+}
+
+/*
+ * Run 1:1 components in place if their source and sink formats match. This
+ * saves the sink buffer memory and a copy through the cache. Must be done at
+ * params time before any downstream DMA is configured on the sink buffer.
+ */
+static int pipeline_inplace(struct comp_dev *dev)
+{
+	struct comp_buffer *source, *sink;
+	int err;
+
+	if (list_is_empty(&dev->bsource_list) || list_is_empty(&dev->bsink_list))
+		return 0;
+
+	source = list_first_item(&dev->bsource_list, struct comp_buffer,
+		sink_list);
+	sink = list_first_item(&dev->bsink_list, struct comp_buffer,
+		source_list);
+
+	/* start from a private sink buffer as upstream may have changed */
+	err = inplace_unlink(sink);
+	if (err < 0)
+		return err;
+
+	if (inplace_valid(dev, source, sink)) {
+		inplace_link(source, sink);
+		tracev_pipe("Inp");
+		tracev_value(dev->comp.id);
+	}
+
+	return 0;
+}
+
 /* call op on all downstream components - locks held by caller */
 static int component_op_downstream(struct op_data *op_data,
 	struct comp_dev *start, struct comp_dev *current,
@@ -340,6 +610,14 @@ static int component_op_downstream(struct op_data *op_data,
 		if (current != start && previous != NULL)
 			comp_install_params(current, previous);
 		err = comp_params(current);
+
+		/* add component load to pipeline estimate */
+		if (err >= 0 && current->pipeline == op_data->p)
+			op_data->kcps += comp_load(current);
+
+		/* process in place before downstream sees the sink buffer */
+		if (err == 0 && current != start && !current->is_endpoint)
+			err = pipeline_inplace(current);
 		break;
 	case COMP_OPS_CMD:
 		/* send command to the component and update pipeline state  */
@@ -355,6 +633,12 @@ static int component_op_downstream(struct op_data *op_data,
 	case COMP_OPS_RESET:
 		/* component should reset and free resources */
 		err = comp_reset(current);
+
+		/* sink buffer gets its own memory back */
+		if (err == 0 && !list_is_empty(&current->bsink_list))
+			err = inplace_unlink(list_first_item(
+				&current->bsink_list, struct comp_buffer,
+				source_list));
 		break;
 	case COMP_OPS_BUFFER: /* handled by other API call */
 	default:
@@ -417,6 +701,10 @@ static int component_op_upstream(struct op_data *op_data,
 		if (current != start && previous != NULL)
 			comp_install_params(current, previous);
 		err = comp_params(current);
+
+		/* add component load to pipeline estimate */
+		if (err >= 0 && current->pipeline == op_data->p)
+			op_data->kcps += comp_load(current);
 		break;
 	case COMP_OPS_CMD:
 		/* send command to the component and update pipeline state  */
@@ -611,12 +899,13 @@ int pipeline_params(struct pipeline *p, struct comp_dev *host,
 	struct sof_ipc_pcm_params *params)
 {
 	struct op_data op_data;
-	int ret;
+	int ret, err;
 
 	trace_pipe("Par");
 
 	op_data.p = p;
 	op_data.op = COMP_OPS_PARAMS;
+	op_data.kcps = 0;
 
 	spin_lock(&p->lock);
 
@@ -633,8 +922,15 @@ int pipeline_params(struct pipeline *p, struct comp_dev *host,
 	if (ret < 0) {
 		trace_ipc_error("pp0");
 		trace_value(host->comp.id);
+		goto out;
 	}
 
+	/* make sure the core has enough MCPS to run pipeline */
+	err = pipeline_load_reserve(p, op_data.kcps);
+	if (err < 0)
+		ret = err;
+
+out:
 	spin_unlock(&p->lock);
 	return ret;
 }
@@ -665,31 +961,61 @@ int pipeline_reset(struct pipeline *p, struct comp_dev *host)
 		trace_value(host->comp.id);
 	}
 
+	/* pipeline load is reserved again at params time */
+	pipeline_load_release(p);
+
 	spin_unlock(&p->lock);
 	return ret;
 }
 
+/* add component to the copy schedule unless it's already scheduled */
+static void copy_list_add(struct pipeline *p, struct comp_dev *dev,
+	uint32_t *count)
+{
+	uint32_t i;
+
+	/* components can be reached by more than one path */
+	for (i = 0; i < *count && i < p->copy_size; i++) {
+		if (p->copy_list[i] == dev)
+			return;
+	}
+
+	/* only store if we have space, caller will resize on overflow */
+	if (*count < p->copy_size)
+		p->copy_list[*count] = dev;
+	(*count)++;
+}
+
+/* can the copy schedule follow this buffer to the next component */
+static inline int copy_list_follow(struct comp_dev *current,
+	struct comp_buffer *buffer, struct comp_dev *next, int all)
+{
+	/* dont follow if this component is not connected */
+	if (!buffer->connected)
+		return 0;
+
+	/* dont follow if this component is from another pipeline */
+	if (next->pipeline != current->pipeline)
+		return 0;
+
+	return all || next->state == COMP_STATE_ACTIVE;
+}
+
 /*
- * Upstream Copy and Process.
+ * Upstream Copy Schedule.
  *
- * Copy period(s) from all upstream sources to this component. The period will
- * be copied and processed by each component from the upstream component
- * end point(s) to the downstream components in a single operation.
- * i.e. the period data is processed from upstream end points to downstream
- * "comp" recursively in a single call to this function.
+ * Add all upstream sources of this component to the copy schedule before
+ * adding this component. i.e. the period data is processed from upstream
+ * end points to downstream "current" in schedule order.
  */
-static int pipeline_copy_from_upstream(struct comp_dev *start,
-	struct comp_dev *current)
+static void copy_list_upstream(struct pipeline *p, struct comp_dev *start,
+	struct comp_dev *current, uint32_t *count, int all)
 {
 	struct list_item *clist;
-	int err = 0;
-
-	tracev_pipe("CP+");
-	tracev_value(current->comp.id);
 
 	/* stop going upstream if we reach an end point in this pipeline */
 	if (current->is_endpoint && current != start)
-		goto copy;
+		goto add;
 
 	/* travel upstream to source end point(s) */
 	list_for_item(clist, &current->bsource_list) {
@@ -697,56 +1023,36 @@ static int pipeline_copy_from_upstream(struct comp_dev *start,
 
 		buffer = container_of(clist, struct comp_buffer, sink_list);
 
-		/* dont go upstream if this component is not connected */
-		if (!buffer->connected || buffer->source->state != COMP_STATE_ACTIVE)
-			continue;
-
-		/* dont go upstream if this source is from another pipeline */
-		if (buffer->source->pipeline != current->pipeline)
+		if (!copy_list_follow(current, buffer, buffer->source, all))
 			continue;
 
-		/* continue upstream */
-		err = pipeline_copy_from_upstream(start, buffer->source);
-		if (err < 0) {
-			trace_pipe_error("ePU");
-			break;
-		}
+		copy_list_upstream(p, start, buffer->source, count, all);
 	}
 
-copy:
-	/* we are at the upstream end point component so copy the buffers */
-	err = comp_copy(current);
-
-	/* return back downstream */
-	tracev_pipe("CD+");
-	return err;
+add:
+	/* sources are all scheduled so now schedule this component */
+	copy_list_add(p, current, count);
 }
 
 /*
- * Downstream Copy and Process.
+ * Downstream Copy Schedule.
  *
- * Copy period(s) from this component to all downstream sinks. The period will
- * be copied and processed by each component from this component to all
- * downstream end point component(s) in a single operation.
- * i.e. the period data is processed from this component to downstream
- * end points recursively in a single call to this function.
+ * Add this component followed by all of its downstream sinks to the copy
+ * schedule. i.e. the period data is processed from "current" to the downstream
+ * end points in schedule order.
  */
-static int pipeline_copy_to_downstream(struct comp_dev *start,
-		struct comp_dev *current)
+static void copy_list_downstream(struct pipeline *p, struct comp_dev *start,
+	struct comp_dev *current, uint32_t *count, int all)
 {
 	struct list_item *clist;
-	int err = 0;
 
-	tracev_pipe("CP-");
-	tracev_value(current->comp.id);
-
-	/* component copy/process to downstream */
+	/* start component is scheduled by the upstream walk */
 	if (current != start) {
-		err = comp_copy(current);
+		copy_list_add(p, current, count);
 
 		/* stop going downstream if we reach an end point in this pipeline */
 		if (current->is_endpoint)
-			return 0;
+			return;
 	}
 
 	/* travel downstream to sink end point(s) */
@@ -755,25 +1061,56 @@ static int pipeline_copy_to_downstream(struct comp_dev *start,
 
 		buffer = container_of(clist, struct comp_buffer, source_list);
 
-		/* dont go downstream if this component is not connected */
-		if (!buffer->connected || buffer->sink->state != COMP_STATE_ACTIVE)
+		if (!copy_list_follow(current, buffer, buffer->sink, all))
 			continue;
 
-		/* dont go downstream if this sink is from another pipeline */
-		if (buffer->sink->pipeline != current->pipeline)
-			continue;
+		copy_list_downstream(p, start, buffer->sink, count, all);
+	}
+}
 
-		/* continue downstream */
-		err = pipeline_copy_to_downstream(start, buffer->sink);
-		if (err < 0) {
-			trace_pipe_error("ePD");
-			break;
+/*
+ * Compile the pipeline graph into a flat copy schedule. The schedule is
+ * walked linearly by the pipeline task so that the per period cost does not
+ * depend on graph depth. all selects every connected component regardless
+ * of state and is used to size the schedule.
+ */
+static int copy_list_build(struct pipeline *p, int all)
+{
+	struct comp_dev **list;
+	struct comp_dev *dev = p->sched_comp;
+	uint32_t count = 0;
+
+	tracev_pipe("CLb");
+
+	p->copy_dirty = 0;
+
+	copy_list_upstream(p, dev, dev, &count, all);
+	copy_list_downstream(p, dev, dev, &count, all);
+
+	/* do we need more space ? */
+	if (count > p->copy_size) {
+
+		list = rzalloc(RZONE_RUNTIME, RFLAGS_NONE, sizeof(*list) * count);
+		if (list == NULL) {
+			trace_pipe_error("eCL");
+			p->copy_count = 0;
+			p->copy_dirty = 1;
+			return -ENOMEM;
 		}
+
+		rfree(p->copy_list);
+		p->copy_list = list;
+		p->copy_size = count;
+
+		/* now fill the new list */
+		count = 0;
+		copy_list_upstream(p, dev, dev, &count, all);
+		copy_list_downstream(p, dev, dev, &count, all);
 	}
 
-	/* return back upstream */
-	tracev_pipe("CD-");
-	return err;
+	p->copy_count = all ? 0 : count;
+	tracev_value(count);
+	return 0;
 }
 
 static int timestamp_downstream(struct comp_dev *start,
@@ -969,32 +1306,71 @@ void pipeline_xrun(struct pipeline *p, struct comp_dev *dev,
 /* notify pipeline that this component requires buffers emptied/filled */
 void pipeline_schedule_copy(struct pipeline *p, uint64_t start)
 {
+	/* timer driven pipelines are rescheduled by the scheduler */
+	if (p->ipc_pipe.timer)
+		return;
+
 	if (p->sched_comp->state == COMP_STATE_ACTIVE)
 		schedule_task(&p->pipe_task, start, p->ipc_pipe.deadline);
 }
 
 void pipeline_schedule_cancel(struct pipeline *p)
 {
-	schedule_task_complete(&p->pipe_task);
+	schedule_task_del(&p->pipe_task);
+}
+
+/* sync buffers shared with pipelines running on other cores */
+static void pipeline_core_sync(struct pipeline *p)
+{
+	struct comp_dev *dev;
+	struct comp_buffer *buffer;
+	struct list_item *clist;
+	uint32_t i;
+
+	for (i = 0; i < p->copy_count; i++) {
+		dev = p->copy_list[i];
+
+		/* data produced by the other core, positions are read
+		 * from memory by the buffer on demand
+		 */
+		list_for_item(clist, &dev->bsource_list) {
+			buffer = container_of(clist, struct comp_buffer,
+				sink_list);
+			if (buffer->cross_core)
+				comp_buffer_core_sync(buffer);
+		}
+	}
 }
 
 static void pipeline_task(void *arg)
 {
 	struct pipeline *p = arg;
-	struct comp_dev *dev = p->sched_comp;
+	struct comp_dev *dev;
+	uint32_t i;
+	int err;
 
 	tracev_pipe("PWs");
 
+	/* rebuild copy schedule if graph or component states have changed */
+	if (p->copy_dirty)
+		copy_list_build(p, 0);
+
+	/* pick up changes made by pipelines on other cores */
+	if (p->cross_core)
+		pipeline_core_sync(p);
+
 	/* copy data from upstream source enpoints to downstream endpoints */
-	pipeline_copy_from_upstream(dev, dev);
-	pipeline_copy_to_downstream(dev, dev);
+	for (i = 0; i < p->copy_count; i++) {
+		dev = p->copy_list[i];
 
-	tracev_pipe("PWe");
+		err = comp_copy(dev);
+		if (err < 0) {
+			trace_pipe_error("ePC");
+			trace_value(dev->comp.id);
+		}
+	}
 
-	/* now reschedule the task */
-	/* TODO: add in scheduling cost and any timer drift */
-	if (p->ipc_pipe.timer)
-		pipeline_schedule_copy(p, p->ipc_pipe.deadline);
+	tracev_pipe("PWe");
 }
 
 /* init pipeline */
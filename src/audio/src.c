@@ -55,12 +55,12 @@
 
 /* src component private data */
 struct comp_data {
-	struct polyphase_src src[PLATFORM_MAX_CHANNELS];
+	struct polyphase_src src; /* all channels, interleaved */
 	int32_t *delay_lines;
 	uint32_t sink_rate;
 	uint32_t source_rate;
 	uint32_t period_bytes; /* sink period */
-	int scratch_length; /* Buffer for stage1-stage2 */
+	int scratch_length; /* Buffer for stage1-stage2, in samples */
 	int sign_extend_s24; /* Set if need to copy sign bit to b24..b31 */
 	void (*src_func)(struct comp_dev *dev,
 		struct comp_buffer *source,
@@ -77,13 +77,10 @@ static void src_muted_s32(struct comp_buffer *source, struct comp_buffer *sink,
 {
 
 	int i;
-	int32_t *src = (int32_t *) source->r_ptr;
 	int32_t *dest = (int32_t *) sink->w_ptr;
 	int32_t *end = (int32_t *) sink->end_addr;
-	int n_read = 0;
 	int n_max;
 	int n;
-	int n_written = 0;
 
 	for (i = 0; i < source_frames - blk_in + 1; i += blk_in) {
 		n_max = end - dest;
@@ -98,11 +95,7 @@ static void src_muted_s32(struct comp_buffer *source, struct comp_buffer *sink,
 			bzero(dest, (n - n_max) * sizeof(int32_t));
 			dest += n - n_max;
 		}
-		n_read += nch*blk_in;
-		n_written += nch*blk_out;
 	}
-	source->r_ptr = src + n_read;
-	sink->w_ptr = dest;
 }
 
 /* Fallback function to just output muted samples and advance
@@ -119,140 +112,107 @@ static void fallback_s32(struct comp_dev *dev,
 
 	struct comp_data *cd = comp_get_drvdata(dev);
 	int nch = dev->params.channels;
-	int blk_in = cd->src[0].blk_in;
-	int blk_out = cd->src[0].blk_out;
+	int blk_in = cd->src.blk_in;
+	int blk_out = cd->src.blk_out;
 
 	src_muted_s32(source, sink, blk_in, blk_out, nch, source_frames);
 
 }
 
-/* Normal 2 stage SRC */
+/* Normal 2 stage SRC, all channels are processed together from the
+ * interleaved source to the interleaved sink via an interleaved scratch
+ * buffer.
+ */
 static void src_2s_s32_default(struct comp_dev *dev,
 	struct comp_buffer *source, struct comp_buffer *sink,
 	uint32_t source_frames, uint32_t sink_frames)
 {
-	int i, j;
+	int i;
 	struct polyphase_src *s;
 	struct comp_data *cd = comp_get_drvdata(dev);
-	int blk_in = cd->src[0].blk_in;
-	int blk_out = cd->src[0].blk_out;
-	int n_times1 = cd->src[0].stage1_times;
-	int n_times2 = cd->src[0].stage2_times;
+	int blk_in = cd->src.blk_in;
+	int blk_out = cd->src.blk_out;
 	int nch = dev->params.channels;
-	int32_t *dest = (int32_t *) sink->w_ptr;
-	int32_t *src = (int32_t *) source->r_ptr;
 	struct src_stage_prm s1, s2;
-	int n_read = 0;
-	int n_written = 0;
 
-	if (cd->src[0].mute) {
-		src_muted_s32(source, sink, blk_in, blk_out, nch, source_frames);
+	s = &cd->src;
+	if (s->mute) {
+		src_muted_s32(source, sink, blk_in, blk_out, nch,
+			source_frames);
 		return;
 	}
 
-	s1.times = n_times1;
+	s1.times = s->stage1_times;
+	s1.x_rptr = (int32_t *) source->r_ptr;
 	s1.x_end_addr = source->end_addr;
 	s1.x_size = source->size;
-	s1.x_inc = nch;
 	s1.y_end_addr = &cd->delay_lines[cd->scratch_length];
 	s1.y_size = cd->scratch_length * sizeof(int32_t);
-	s1.y_inc = 1;
+	s1.nch = nch;
+	s1.state = &s->state1;
+	s1.stage = s->stage1;
 
-	s2.times = n_times2;
+	s2.times = s->stage2_times;
 	s2.x_end_addr = &cd->delay_lines[cd->scratch_length];
 	s2.x_size = cd->scratch_length * sizeof(int32_t);
-	s2.x_inc = 1;
+	s2.y_wptr = (int32_t *) sink->w_ptr;
 	s2.y_end_addr = sink->end_addr;
 	s2.y_size = sink->size;
-	s2.y_inc = nch;
-
-	s1.x_rptr = src + nch - 1;
-	s2.y_wptr = dest + nch - 1;
-
-	for (j = 0; j < nch; j++) {
-		s = &cd->src[j]; /* Point to src[] for this channel */
-		s1.x_rptr = src++;
-		s2.y_wptr = dest++;
-		s1.state = &s->state1;
-		s1.stage = s->stage1;
-		s2.state = &s->state2;
-		s2.stage = s->stage2;
-
-		for (i = 0; i < source_frames - blk_in + 1; i += blk_in) {
-			/* Reset output to buffer start, read interleaved */
-			s1.y_wptr = cd->delay_lines;
-			s2.x_rptr = cd->delay_lines;
-			if (cd->sign_extend_s24) {
-				src_polyphase_stage_cir_s24(&s1);
-				src_polyphase_stage_cir_s24(&s2);
-			} else {
-				src_polyphase_stage_cir(&s1);
-				src_polyphase_stage_cir(&s2);
-			}
-
-			n_read += blk_in;
-			n_written += blk_out;
+	s2.nch = nch;
+	s2.state = &s->state2;
+	s2.stage = s->stage2;
+
+	for (i = 0; i + blk_in - 1 < source_frames; i += blk_in) {
+		/* Reset scratch to buffer start */
+		s1.y_wptr = cd->delay_lines;
+		s2.x_rptr = cd->delay_lines;
+		if (cd->sign_extend_s24) {
+			src_polyphase_stage_cir_s24(&s1);
+			src_polyphase_stage_cir_s24(&s2);
+		} else {
+			src_polyphase_stage_cir(&s1);
+			src_polyphase_stage_cir(&s2);
 		}
 	}
-	source->r_ptr = s1.x_rptr - nch + 1;
-	sink->w_ptr = s2.y_wptr - nch + 1;
 }
 
-/* 1 stage SRC for simple conversions */
+/* 1 stage SRC for simple conversions, all channels processed together */
 static void src_1s_s32_default(struct comp_dev *dev,
 	struct comp_buffer *source, struct comp_buffer *sink,
 	uint32_t source_frames, uint32_t sink_frames)
 {
-	int i, j;
+	int i;
 	struct polyphase_src *s;
-
 	struct comp_data *cd = comp_get_drvdata(dev);
-	int blk_in = cd->src[0].blk_in;
-	int blk_out = cd->src[0].blk_out;
-	int n_times = cd->src[0].stage1_times;
+	int blk_in = cd->src.blk_in;
+	int blk_out = cd->src.blk_out;
 	int nch = dev->params.channels;
-	int32_t *dest = (int32_t *) sink->w_ptr;
-	int32_t *src = (int32_t *) source->r_ptr;
-	int n_read = 0;
-	int n_written = 0;
 	struct src_stage_prm s1;
 
-	if (cd->src[0].mute) {
+	s = &cd->src;
+	if (s->mute) {
 		src_muted_s32(source, sink, blk_in, blk_out, nch,
 			source_frames);
 		return;
 	}
 
-	s1.times = n_times;
+	s1.times = s->stage1_times;
+	s1.x_rptr = (int32_t *) source->r_ptr;
 	s1.x_end_addr = source->end_addr;
 	s1.x_size = source->size;
-	s1.x_inc = nch;
+	s1.y_wptr = (int32_t *) sink->w_ptr;
 	s1.y_end_addr = sink->end_addr;
 	s1.y_size = sink->size;
-	s1.y_inc = nch;
-	s1.x_rptr = src + nch - 1;
-	s1.y_wptr = dest + nch - 1;
-
-	for (j = 0; j < nch; j++) {
-		s = &cd->src[j]; /* Point to src for this channel */
-		s1.x_rptr = src++;
-		s1.y_wptr = dest++;
-		s1.state = &s->state1;
-		s1.stage = s->stage1;
-
-		for (i = 0; i + blk_in - 1 < source_frames; i += blk_in) {
-			if (cd->sign_extend_s24)
-				src_polyphase_stage_cir_s24(&s1);
-			else
-				src_polyphase_stage_cir(&s1);
-
-			n_read += blk_in;
-			n_written += blk_out;
-		}
-
+	s1.nch = nch;
+	s1.state = &s->state1;
+	s1.stage = s->stage1;
+
+	for (i = 0; i + blk_in - 1 < source_frames; i += blk_in) {
+		if (cd->sign_extend_s24)
+			src_polyphase_stage_cir_s24(&s1);
+		else
+			src_polyphase_stage_cir(&s1);
 	}
-	source->r_ptr = s1.x_rptr - nch + 1;
-	sink->w_ptr = s1.y_wptr - nch + 1;
 }
 
 static struct comp_dev *src_new(struct sof_ipc_comp *comp)
@@ -261,7 +221,6 @@ static struct comp_dev *src_new(struct sof_ipc_comp *comp)
 	struct sof_ipc_comp_src *src;
 	struct sof_ipc_comp_src *ipc_src = (struct sof_ipc_comp_src *) comp;
 	struct comp_data *cd;
-	int i;
 
 	trace_src("new");
 
@@ -289,8 +248,7 @@ static struct comp_dev *src_new(struct sof_ipc_comp *comp)
 
 	cd->delay_lines = NULL;
 	cd->src_func = src_2s_s32_default;
-	for (i = 0; i < PLATFORM_MAX_CHANNELS; i++)
-		src_polyphase_reset(&cd->src[i]);
+	src_polyphase_reset(&cd->src);
 
 	dev->state = COMP_STATE_READY;
 	return dev;
@@ -322,7 +280,7 @@ static int src_params(struct comp_dev *dev)
 	size_t delay_lines_size;
 	uint32_t source_rate, sink_rate;
 	int32_t *buffer_start;
-	int n = 0, i, err, frames_is_for_source, nch, q;
+	int n = 0, err, frames_is_for_source, nch, q, blk;
 
 	trace_src("par");
 
@@ -357,6 +315,13 @@ static int src_params(struct comp_dev *dev)
 		frames_is_for_source = 1;
 	}
 
+	/* Channels are processed interleaved with per channel accumulators */
+	if (params->channels == 0 || params->channels > PLATFORM_MAX_CHANNELS) {
+		trace_src_error("sr4");
+		trace_value(params->channels);
+		return -EINVAL;
+	}
+
 	/* Allocate needed memory for delay lines */
 	err = src_buffer_lengths(&need, source_rate, sink_rate,
 		params->channels, dev->frames, frames_is_for_source);
@@ -388,16 +353,13 @@ static int src_params(struct comp_dev *dev)
 
 	/* Clear all delay lines here */
 	memset(cd->delay_lines, 0, delay_lines_size);
-	cd->scratch_length = need.scratch;
-	buffer_start = cd->delay_lines + need.scratch;
+	nch = params->channels;
+	cd->scratch_length = need.scratch * nch;
+	buffer_start = cd->delay_lines + cd->scratch_length;
 
 	/* Initize SRC for actual sample rate */
-	nch = MIN(params->channels, PLATFORM_MAX_CHANNELS);
-	for (i = 0; i < nch; i++) {
-		n = src_polyphase_init(&cd->src[i], source_rate, sink_rate,
-			&need, buffer_start);
-		buffer_start += need.single_src;
-	}
+	n = src_polyphase_init(&cd->src, source_rate, sink_rate, &need, nch,
+		buffer_start);
 
 	switch (n) {
 	case 1:
@@ -417,6 +379,12 @@ static int src_params(struct comp_dev *dev)
 		break;
 	}
 
+	/* Filter cost per frame at the rate passed on to the next component */
+	blk = frames_is_for_source ? src_polyphase_get_blk_in(&cd->src) :
+		src_polyphase_get_blk_out(&cd->src);
+	dev->cycles = (src_polyphase_get_blk_macs(&cd->src) * nch *
+		PLATFORM_MAC_COST + blk - 1) / blk;
+
 	/* Calculate period size based on config. First make sure that
 	 * frame_bytes is set.
 	 */
@@ -457,6 +425,14 @@ static int src_params(struct comp_dev *dev)
 		return -EINVAL;
 	}
 
+	/* frames must never be split by either buffer wrap */
+	if (!buffer_frames_aligned(source, dev->frame_bytes) ||
+		!buffer_frames_aligned(sink, dev->frame_bytes)) {
+		trace_src_error("sr5");
+		trace_value(source->size);
+		trace_value(sink->size);
+		return -EINVAL;
+	}
 
 	return 0;
 }
@@ -464,19 +440,16 @@ static int src_params(struct comp_dev *dev)
 static int src_ctrl_cmd(struct comp_dev *dev, struct sof_ipc_ctrl_data *cdata)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
-	int i;
 
 	switch (cdata->cmd) {
 	case SOF_CTRL_CMD_MUTE:
 		trace_src("SMu");
-		for (i = 0; i < PLATFORM_MAX_CHANNELS; i++)
-			src_polyphase_mute(&cd->src[i]);
+		src_polyphase_mute(&cd->src);
 
 		break;
 	case SOF_CTRL_CMD_UNMUTE:
 		trace_src("SUm");
-		for (i = 0; i < PLATFORM_MAX_CHANNELS; i++)
-			src_polyphase_unmute(&cd->src[i]);
+		src_polyphase_unmute(&cd->src);
 
 		break;
 	default:
@@ -527,19 +500,20 @@ static int src_copy(struct comp_dev *dev)
 	/* Calculate needed amount of source buffer and sink buffer
 	 * for one SRC run.
 	 */
-	blk_in = src_polyphase_get_blk_in(&cd->src[0]);
-	blk_out = src_polyphase_get_blk_out(&cd->src[0]);
+	blk_in = src_polyphase_get_blk_in(&cd->src);
+	blk_out = src_polyphase_get_blk_out(&cd->src);
 	need_source = blk_in * dev->frame_bytes;
 	need_sink = blk_out * dev->frame_bytes;
 
 	/* Run as many times as buffers allow */
-	while ((source->avail >= need_source) && (sink->free >= need_sink)) {
+	while ((comp_buffer_get_avail(source) >= need_source) &&
+		(comp_buffer_get_free(sink) >= need_sink)) {
 		/* Run src */
 		cd->src_func(dev, source, sink, blk_in, blk_out);
 
 		/* calc new free and available  */
-		comp_update_buffer_consume(source, 0);
-		comp_update_buffer_produce(sink, 0);
+		comp_update_buffer_consume(source, need_source);
+		comp_update_buffer_produce(sink, need_sink);
 	}
 
 	return 0;
@@ -558,14 +532,12 @@ static int src_preload(struct comp_dev *dev)
 
 static int src_reset(struct comp_dev *dev)
 {
-	int i;
 	struct comp_data *cd = comp_get_drvdata(dev);
 
 	trace_src("SRe");
 
 	cd->src_func = src_2s_s32_default;
-	for (i = 0; i < PLATFORM_MAX_CHANNELS; i++)
-		src_polyphase_reset(&cd->src[i]);
+	src_polyphase_reset(&cd->src);
 
 	dev->state = COMP_STATE_READY;
 	return 0;
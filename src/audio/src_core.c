@@ -42,6 +42,7 @@
 #include <reef/alloc.h>
 #include <reef/audio/format.h>
 #include <reef/math/numbers.h>
+#include <platform/platform.h>
 #include "src_core.h"
 #include "src_config.h"
 
@@ -168,8 +169,10 @@ int src_buffer_lengths(struct src_alloc *a, int fs_in, int fs_out, int nch,
 		a->out_s2 = src_out_delay_length(stage2);
 		a->scratch = stage1->blk_out * s1_times * k;
 	}
+
+	/* Scratch and delay lines hold interleaved frames of nch samples */
 	a->single_src = a->fir_s1 + a->fir_s2 + a->out_s1 + a->out_s2;
-	a->total = a->scratch + nch * a->single_src;
+	a->total = nch * (a->scratch + a->single_src);
 
 	return 0;
 }
@@ -188,7 +191,7 @@ static void src_state_reset(struct src_state *state)
 static int init_stages(
 	struct src_stage *stage1, struct src_stage *stage2,
 	struct polyphase_src *src, struct src_alloc *res,
-	int n, int32_t *delay_lines_start)
+	int n, int nch, int32_t *delay_lines_start)
 {
 	/* Clear FIR state */
 	src_state_reset(&src->state1);
@@ -211,19 +214,20 @@ static int init_stages(
 		src->blk_out = res->blk_out;
 	}
 
-	/* Delay line sizes */
+	/* Delay line sizes in frames, each frame is nch samples */
+	src->nch = nch;
 	src->state1.fir_delay_size = res->fir_s1;
 	src->state1.out_delay_size = res->out_s1;
 	src->state1.fir_delay = delay_lines_start;
 	src->state1.out_delay =
-		src->state1.fir_delay + src->state1.fir_delay_size;
+		src->state1.fir_delay + src->state1.fir_delay_size * nch;
 	if (n > 1) {
 		src->state2.fir_delay_size = res->fir_s2;
 		src->state2.out_delay_size = res->out_s2;
-		src->state2.fir_delay =
-			src->state1.out_delay + src->state1.out_delay_size;
-		src->state2.out_delay =
-			src->state2.fir_delay + src->state2.fir_delay_size;
+		src->state2.fir_delay = src->state1.out_delay
+			+ src->state1.out_delay_size * nch;
+		src->state2.out_delay = src->state2.fir_delay
+			+ src->state2.fir_delay_size * nch;
 	} else {
 		src->state2.fir_delay_size = 0;
 		src->state2.out_delay_size = 0;
@@ -251,6 +255,7 @@ void src_polyphase_reset(struct polyphase_src *src)
 {
 
 	src->mute = 0;
+	src->nch = 0;
 	src->number_of_stages = 0;
 	src->blk_in = 0;
 	src->blk_out = 0;
@@ -263,7 +268,7 @@ void src_polyphase_reset(struct polyphase_src *src)
 }
 
 int src_polyphase_init(struct polyphase_src *src, int fs1, int fs2,
-	struct src_alloc *res, int32_t *delay_lines_start)
+	struct src_alloc *res, int nch, int32_t *delay_lines_start)
 {
 	int n_stages, ret;
 	struct src_stage *stage1, *stage2;
@@ -277,7 +282,8 @@ int src_polyphase_init(struct polyphase_src *src, int fs1, int fs2,
 	/* Get setup for 2 stage conversion */
 	stage1 = src_table1[res->idx_out][res->idx_in];
 	stage2 = src_table2[res->idx_out][res->idx_in];
-	ret = init_stages(stage1, stage2, src, res, 2, delay_lines_start);
+	ret = init_stages(stage1, stage2, src, res, 2, nch,
+		delay_lines_start);
 	if (ret < 0)
 		return -EINVAL;
 
@@ -298,309 +304,311 @@ int src_polyphase_init(struct polyphase_src *src, int fs1, int fs2,
 
 #if SRC_SHORT == 1
 
-/* Calculate a FIR filter part that does not need circular modification */
-static inline void fir_part(int64_t *y, int ntaps, const int16_t c[], int *ic,
-	int32_t d[], int *id)
+/* Calculate a FIR filter part that does not need circular modification.
+ * The delay line is interleaved so each coefficient is loaded once and
+ * applied to all channels of the frame. The channel count is a constant for
+ * the common stream layouts and each channel has its own accumulator so
+ * they are kept in registers.
+ */
+static inline void fir_part(int64_t y[], int ntaps, const int16_t c[], int *ic,
+	int32_t d[], int *id, const int nch)
 {
-	int64_t p;
+	int32_t *dp = &d[*id * nch];
+	int64_t y0 = 0;
+	int64_t y1 = 0;
+	int64_t y2 = 0;
+	int64_t y3 = 0;
+	int16_t tap;
 	int n;
+#if PLATFORM_MAX_CHANNELS > 4
+	int j;
+
+	if (nch > 4) {
+		/* Data is Q1.31, coef is Q1.15, product is Q2.46 */
+		for (n = 0; n < ntaps; n++) {
+			tap = c[(*ic)++];
+			for (j = 0; j < nch; j++)
+				y[j] += (int64_t) tap * dp[j];
+			dp -= nch;
+		}
+		*id -= ntaps;
+		return;
+	}
+#endif
 
 	/* Data is Q1.31, coef is Q1.15, product is Q2.46 */
 	for (n = 0; n < ntaps; n++) {
-		p = (int64_t) c[(*ic)++] * d[(*id)--];
-		*y += p;
+		tap = c[(*ic)++];
+		y0 += (int64_t) tap * dp[0];
+		if (nch > 1)
+			y1 += (int64_t) tap * dp[1];
+		if (nch > 2)
+			y2 += (int64_t) tap * dp[2];
+		if (nch > 3)
+			y3 += (int64_t) tap * dp[3];
+		dp -= nch;
 	}
+	*id -= ntaps;
+
+	y[0] += y0;
+	if (nch > 1)
+		y[1] += y1;
+	if (nch > 2)
+		y[2] += y2;
+	if (nch > 3)
+		y[3] += y3;
 }
 #else
 
-/* Calculate a FIR filter part that does not need circular modification */
-static inline void fir_part(int64_t *y, int ntaps, const int32_t c[], int *ic,
-	int32_t d[], int *id)
+/* Calculate a FIR filter part that does not need circular modification.
+ * The delay line is interleaved so each coefficient is loaded once and
+ * applied to all channels of the frame. The channel count is a constant for
+ * the common stream layouts and each channel has its own accumulator so
+ * they are kept in registers.
+ */
+static inline void fir_part(int64_t y[], int ntaps, const int32_t c[], int *ic,
+	int32_t d[], int *id, const int nch)
 {
-	int64_t p;
+	int32_t *dp = &d[*id * nch];
+	int64_t y0 = 0;
+	int64_t y1 = 0;
+	int64_t y2 = 0;
+	int64_t y3 = 0;
+	int32_t tap;
 	int n;
+#if PLATFORM_MAX_CHANNELS > 4
+	int j;
+
+	if (nch > 4) {
+		/* Data is Q8.24, coef is Q1.23, product is Q9.47 */
+		for (n = 0; n < ntaps; n++) {
+			tap = c[(*ic)++];
+			for (j = 0; j < nch; j++)
+				y[j] += (int64_t) tap * dp[j];
+			dp -= nch;
+		}
+		*id -= ntaps;
+		return;
+	}
+#endif
 
 	/* Data is Q8.24, coef is Q1.23, product is Q9.47 */
 	for (n = 0; n < ntaps; n++) {
-
-		p = (int64_t) c[(*ic)++] * d[(*id)--];
-		*y += p;
+		tap = c[(*ic)++];
+		y0 += (int64_t) tap * dp[0];
+		if (nch > 1)
+			y1 += (int64_t) tap * dp[1];
+		if (nch > 2)
+			y2 += (int64_t) tap * dp[2];
+		if (nch > 3)
+			y3 += (int64_t) tap * dp[3];
+		dp -= nch;
 	}
+	*id -= ntaps;
+
+	y[0] += y0;
+	if (nch > 1)
+		y[1] += y1;
+	if (nch > 2)
+		y[2] += y2;
+	if (nch > 3)
+		y[3] += y3;
 }
 #endif
 
 #if SRC_SHORT == 1
 
-static inline int32_t fir_filter(
+static inline void fir_filter(
 	struct src_state *fir, const int16_t coefs[],
-	int *coefi, int filter_length, int shift)
+	int *coefi, int filter_length, int shift, int32_t z[], const int nch)
 {
-	int64_t y = 0;
+	int64_t y[PLATFORM_MAX_CHANNELS];
 	int n1;
 	int n2;
+	int j;
+
+	for (j = 0; j < nch; j++)
+		y[j] = 0;
 
 	n1 = fir->fir_ri + 1;
 	if (n1 > filter_length) {
 		/* No need to un-wrap fir read index, make sure fir_fi
 		 * is ge 0 after FIR computation.
 		 */
-		fir_part(&y, filter_length, coefs, coefi, fir->fir_delay,
-			&fir->fir_ri);
+		fir_part(y, filter_length, coefs, coefi, fir->fir_delay,
+			&fir->fir_ri, nch);
 	} else {
 		n2 = filter_length - n1;
 		/* Part 1, loop n1 times, fir_ri becomes -1 */
-		fir_part(&y, n1, coefs, coefi, fir->fir_delay, &fir->fir_ri);
+		fir_part(y, n1, coefs, coefi, fir->fir_delay, &fir->fir_ri,
+			nch);
 
 		/* Part 2, unwrap fir_ri, continue rest of filter */
 		fir->fir_ri = fir->fir_delay_size - 1;
-		fir_part(&y, n2, coefs, coefi, fir->fir_delay, &fir->fir_ri);
+		fir_part(y, n2, coefs, coefi, fir->fir_delay, &fir->fir_ri,
+			nch);
 	}
-	/* Q2.46 -> Q2.31, saturate to Q1.31 */
-	y = y >> (15 + shift);
 
-	return (int32_t) sat_int32(y);
+	/* Q2.46 -> Q2.31, saturate to Q1.31 */
+	for (j = 0; j < nch; j++)
+		z[j] = (int32_t) sat_int32(y[j] >> (15 + shift));
 }
 #else
 
-static inline int32_t fir_filter(
+static inline void fir_filter(
 	struct src_state *fir, const int32_t coefs[],
-	int *coefi, int filter_length, int shift)
+	int *coefi, int filter_length, int shift, int32_t z[], const int nch)
 {
-	int64_t y = 0;
+	int64_t y[PLATFORM_MAX_CHANNELS];
 	int n1;
 	int n2;
+	int j;
+
+	for (j = 0; j < nch; j++)
+		y[j] = 0;
 
 	n1 = fir->fir_ri + 1;
 	if (n1 > filter_length) {
 		/* No need to un-wrap fir read index, make sure fir_fi
 		 * is ge 0 after FIR computation.
 		 */
-		fir_part(&y, filter_length, coefs, coefi, fir->fir_delay,
-			&fir->fir_ri);
+		fir_part(y, filter_length, coefs, coefi, fir->fir_delay,
+			&fir->fir_ri, nch);
 	} else {
 		n2 = filter_length - n1;
 		/* Part 1, loop n1 times, fir_ri becomes -1 */
-		fir_part(&y, n1, coefs, coefi, fir->fir_delay, &fir->fir_ri);
+		fir_part(y, n1, coefs, coefi, fir->fir_delay, &fir->fir_ri,
+			nch);
 
 		/* Part 2, unwrap fir_ri, continue rest of filter */
 		fir->fir_ri = fir->fir_delay_size - 1;
-		fir_part(&y, n2, coefs, coefi, fir->fir_delay, &fir->fir_ri);
+		fir_part(y, n2, coefs, coefi, fir->fir_delay, &fir->fir_ri,
+			nch);
 	}
-	/* Q9.47 -> Q9.24, saturate to Q8.24 */
-	y = y >> (23 + shift);
 
-	return (int32_t) sat_int32(y);
+	/* Q9.47 -> Q9.24, saturate to Q8.24 */
+	for (j = 0; j < nch; j++)
+		z[j] = (int32_t) sat_int32(y[j] >> (23 + shift));
 }
 #endif
 
-void src_polyphase_stage_cir(struct src_stage_prm *s)
+/* Run a polyphase stage for all interleaved channels. Source, sink and
+ * the FIR and output delay lines all hold nch interleaved samples per
+ * frame, indexes and sizes in the state are in frames.
+ */
+static inline void src_polyphase_stage(struct src_stage_prm *s,
+	const int sign_extend_s24)
 {
-	int n, m, f, c, r, n_wrap_fir, n_wrap_buf, n_wrap_min;
-	int32_t z;
+	struct src_state *state = s->state;
+	struct src_stage *stage = s->stage;
+	int nch = s->nch;
+	int n, m, f, c, r, i, n_wrap_fir, n_wrap_buf, n_min;
+	int32_t *d, *z;
 
 	for (n = 0; n < s->times; n++) {
-		/* Input data */
-		m = s->x_inc * s->stage->blk_in;
+		/* Input data, copy whole frames up to next wrap */
+		m = stage->blk_in;
 		while (m > 0) {
-			n_wrap_fir =
-				(s->state->fir_delay_size - s->state->fir_wi)
-				* s->x_inc;
-			n_wrap_buf = s->x_end_addr - s->x_rptr;
-			n_wrap_min = (n_wrap_fir < n_wrap_buf)
-				? n_wrap_fir : n_wrap_buf;
-			if (m < n_wrap_min) {
-				/* No circular wrap need */
-				while (m > 0) {
-					s->state->fir_delay[s->state->fir_wi++]
-						= *s->x_rptr;
-					s->x_rptr += s->x_inc;
-					m -= s->x_inc;
-				}
+			n_wrap_fir = state->fir_delay_size - state->fir_wi;
+			n_wrap_buf = (s->x_end_addr - s->x_rptr) / nch;
+			n_min = MIN(m, MIN(n_wrap_fir, n_wrap_buf));
+
+			d = &state->fir_delay[state->fir_wi * nch];
+			if (sign_extend_s24) {
+				for (i = 0; i < n_min * nch; i++)
+					d[i] = (s->x_rptr[i] << 8) >> 8;
 			} else {
-				/* Wrap in n_wrap_min/x_inc samples */
-				while (n_wrap_min > 0) {
-					s->state->fir_delay[s->state->fir_wi++]
-						= *s->x_rptr;
-					s->x_rptr += s->x_inc;
-					n_wrap_min -= s->x_inc;
-					m -= s->x_inc;
-				}
-				/* Check both */
-				if (s->x_rptr >= s->x_end_addr)
-					s->x_rptr = (int32_t *)
-					((size_t) s->x_rptr - s->x_size);
-				if (s->state->fir_wi
-					== s->state->fir_delay_size)
-					s->state->fir_wi = 0;
+				for (i = 0; i < n_min * nch; i++)
+					d[i] = s->x_rptr[i];
 			}
+
+			s->x_rptr += n_min * nch;
+			state->fir_wi += n_min;
+			m -= n_min;
+
+			/* Check both */
+			if (s->x_rptr >= s->x_end_addr)
+				s->x_rptr = (int32_t *)
+					((size_t) s->x_rptr - s->x_size);
+			if (state->fir_wi == state->fir_delay_size)
+				state->fir_wi = 0;
 		}
 
 		/* Filter */
 		c = 0;
-		r = s->state->fir_wi - s->stage->blk_in
-			- (s->stage->num_of_subfilters - 1) * s->stage->idm;
+		r = state->fir_wi - stage->blk_in
+			- (stage->num_of_subfilters - 1) * stage->idm;
 		if (r < 0)
-			r += s->state->fir_delay_size;
-
-		s->state->out_wi = s->state->out_ri;
-		for (f = 0; f < s->stage->num_of_subfilters; f++) {
-			s->state->fir_ri = r;
-			z = fir_filter(s->state, s->stage->coefs, &c,
-				s->stage->subfilter_length, s->stage->shift);
-			r += s->stage->idm;
-			if (r > s->state->fir_delay_size - 1)
-				r -= s->state->fir_delay_size;
-
-			s->state->out_delay[s->state->out_wi] = z;
-			s->state->out_wi += s->stage->odm;
-			if (s->state->out_wi > s->state->out_delay_size - 1)
-				s->state->out_wi -= s->state->out_delay_size;
+			r += state->fir_delay_size;
+
+		state->out_wi = state->out_ri;
+		for (f = 0; f < stage->num_of_subfilters; f++) {
+			state->fir_ri = r;
+			z = &state->out_delay[state->out_wi * nch];
+			switch (nch) {
+			case 1:
+				fir_filter(state, stage->coefs, &c,
+					stage->subfilter_length, stage->shift,
+					z, 1);
+				break;
+			case 2:
+				fir_filter(state, stage->coefs, &c,
+					stage->subfilter_length, stage->shift,
+					z, 2);
+				break;
+			case 4:
+				fir_filter(state, stage->coefs, &c,
+					stage->subfilter_length, stage->shift,
+					z, 4);
+				break;
+			default:
+				fir_filter(state, stage->coefs, &c,
+					stage->subfilter_length, stage->shift,
+					z, nch);
+				break;
+			}
+			r += stage->idm;
+			if (r > state->fir_delay_size - 1)
+				r -= state->fir_delay_size;
+
+			state->out_wi += stage->odm;
+			if (state->out_wi > state->out_delay_size - 1)
+				state->out_wi -= state->out_delay_size;
 		}
 
-		/* Output */
-		m = s->y_inc * s->stage->num_of_subfilters;
+		/* Output, copy whole frames up to next wrap */
+		m = stage->num_of_subfilters;
 		while (m > 0) {
-			n_wrap_fir =
-				(s->state->out_delay_size - s->state->out_ri)
-				* s->y_inc;
-			n_wrap_buf = s->y_end_addr - s->y_wptr;
-			n_wrap_min = (n_wrap_fir < n_wrap_buf)
-				? n_wrap_fir : n_wrap_buf;
-			if (m < n_wrap_min) {
-				/* No circular wrap need */
-				while (m > 0) {
-					*s->y_wptr = s->state->out_delay[
-						s->state->out_ri++];
-					s->y_wptr += s->y_inc;
-					m -= s->y_inc;
-				}
-			} else {
-				/* Wrap in n_wrap_min/y_inc samples */
-				while (n_wrap_min > 0) {
-					*s->y_wptr = s->state->out_delay[
-						s->state->out_ri++];
-					s->y_wptr += s->y_inc;
-					n_wrap_min -= s->y_inc;
-					m -= s->y_inc;
-				}
-				/* Check both */
-				if (s->y_wptr >= s->y_end_addr)
-					s->y_wptr =
-					(int32_t *)
-					((size_t) s->y_wptr - s->y_size);
+			n_wrap_fir = state->out_delay_size - state->out_ri;
+			n_wrap_buf = (s->y_end_addr - s->y_wptr) / nch;
+			n_min = MIN(m, MIN(n_wrap_fir, n_wrap_buf));
 
-				if (s->state->out_ri
-					== s->state->out_delay_size)
-					s->state->out_ri = 0;
-			}
+			d = &state->out_delay[state->out_ri * nch];
+			for (i = 0; i < n_min * nch; i++)
+				s->y_wptr[i] = d[i];
+
+			s->y_wptr += n_min * nch;
+			state->out_ri += n_min;
+			m -= n_min;
+
+			/* Check both */
+			if (s->y_wptr >= s->y_end_addr)
+				s->y_wptr = (int32_t *)
+					((size_t) s->y_wptr - s->y_size);
+			if (state->out_ri == state->out_delay_size)
+				state->out_ri = 0;
 		}
 	}
 }
 
-void src_polyphase_stage_cir_s24(struct src_stage_prm *s)
+void src_polyphase_stage_cir(struct src_stage_prm *s)
 {
-	int n, m, f, c, r, n_wrap_fir, n_wrap_buf, n_wrap_min;
-	int32_t se, z;
-
-	for (n = 0; n < s->times; n++) {
-		/* Input data */
-		m = s->x_inc * s->stage->blk_in;
-		while (m > 0) {
-			n_wrap_fir =
-				(s->state->fir_delay_size - s->state->fir_wi)
-				* s->x_inc;
-			n_wrap_buf = s->x_end_addr - s->x_rptr;
-			n_wrap_min = (n_wrap_fir < n_wrap_buf)
-				? n_wrap_fir : n_wrap_buf;
-			if (m < n_wrap_min) {
-				/* No circular wrap need */
-				while (m > 0) {
-					se = *s->x_rptr << 8;
-					s->state->fir_delay[s->state->fir_wi++]
-						= se >> 8;
-					s->x_rptr += s->x_inc;
-					m -= s->x_inc;
-				}
-			} else {
-				/* Wrap in n_wrap_min/x_inc samples */
-				while (n_wrap_min > 0) {
-					se = *s->x_rptr << 8;
-					s->state->fir_delay[s->state->fir_wi++]
-						= se >> 8;
-					s->x_rptr += s->x_inc;
-					n_wrap_min -= s->x_inc;
-					m -= s->x_inc;
-				}
-				/* Check both */
-				if (s->x_rptr >= s->x_end_addr)
-					s->x_rptr = (int32_t *)
-					((size_t) s->x_rptr - s->x_size);
-				if (s->state->fir_wi
-					== s->state->fir_delay_size)
-					s->state->fir_wi = 0;
-			}
-		}
-
-		/* Filter */
-		c = 0;
-		r = s->state->fir_wi - s->stage->blk_in
-			- (s->stage->num_of_subfilters - 1) * s->stage->idm;
-		if (r < 0)
-			r += s->state->fir_delay_size;
-
-		s->state->out_wi = s->state->out_ri;
-		for (f = 0; f < s->stage->num_of_subfilters; f++) {
-			s->state->fir_ri = r;
-			z = fir_filter(s->state, s->stage->coefs, &c,
-				s->stage->subfilter_length, s->stage->shift);
-			r += s->stage->idm;
-			if (r > s->state->fir_delay_size - 1)
-				r -= s->state->fir_delay_size;
-
-			s->state->out_delay[s->state->out_wi] = z;
-			s->state->out_wi += s->stage->odm;
-			if (s->state->out_wi > s->state->out_delay_size - 1)
-				s->state->out_wi -= s->state->out_delay_size;
-		}
-
-		/* Output */
-		m = s->y_inc * s->stage->num_of_subfilters;
-		while (m > 0) {
-			n_wrap_fir =
-				(s->state->out_delay_size - s->state->out_ri)
-				* s->y_inc;
-			n_wrap_buf = s->y_end_addr - s->y_wptr;
-			n_wrap_min = (n_wrap_fir < n_wrap_buf)
-				? n_wrap_fir : n_wrap_buf;
-			if (m < n_wrap_min) {
-				/* No circular wrap need */
-				while (m > 0) {
-					*s->y_wptr = s->state->out_delay[
-						s->state->out_ri++];
-					s->y_wptr += s->y_inc;
-					m -= s->y_inc;
-				}
-			} else {
-				/* Wrap in n_wrap_min/y_inc samples */
-				while (n_wrap_min > 0) {
-					*s->y_wptr = s->state->out_delay[
-						s->state->out_ri++];
-					s->y_wptr += s->y_inc;
-					n_wrap_min -= s->y_inc;
-					m -= s->y_inc;
-				}
-				/* Check both */
-				if (s->y_wptr >= s->y_end_addr)
-					s->y_wptr =
-					(int32_t *)
-					((size_t) s->y_wptr - s->y_size);
+	src_polyphase_stage(s, 0);
+}
 
-				if (s->state->out_ri
-					== s->state->out_delay_size)
-					s->state->out_ri = 0;
-			}
-		}
-	}
+void src_polyphase_stage_cir_s24(struct src_stage_prm *s)
+{
+	src_polyphase_stage(s, 1);
 }
 
 #ifdef MODULE_TEST
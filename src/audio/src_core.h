@@ -78,6 +78,7 @@ struct src_state {
 
 struct polyphase_src {
 	int mute;
+	int nch;
 	int number_of_stages;
 	int blk_in;
 	int blk_out;
@@ -94,11 +95,10 @@ struct src_stage_prm {
 	int32_t *x_rptr;
 	int32_t *x_end_addr;
 	size_t x_size;
-	int x_inc;
 	int32_t *y_wptr;
 	int32_t *y_end_addr;
 	size_t y_size;
-	int y_inc;
+	int nch;
 	struct src_state *state;
 	struct src_stage *stage;
 };
@@ -128,10 +128,23 @@ static inline int src_polyphase_get_blk_out(struct polyphase_src *src)
 	return src->blk_out;
 }
 
+/* filter MACs per channel to convert one blk_in to blk_out block */
+static inline int src_polyphase_get_blk_macs(struct polyphase_src *src)
+{
+	int macs = src->stage1_times * src->stage1->num_of_subfilters *
+		src->stage1->subfilter_length;
+
+	if (src->number_of_stages > 1)
+		macs += src->stage2_times * src->stage2->num_of_subfilters *
+			src->stage2->subfilter_length;
+
+	return macs;
+}
+
 void src_polyphase_reset(struct polyphase_src *src);
 
 int src_polyphase_init(struct polyphase_src *src, int fs1, int fs2,
-	struct src_alloc *res, int32_t *delay_lines_start);
+	struct src_alloc *res, int nch, int32_t *delay_lines_start);
 
 int src_polyphase(struct polyphase_src *src, int32_t x[], int32_t y[],
 	int n_in);
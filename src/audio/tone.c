@@ -97,47 +97,38 @@ static void tone_s32_default(struct comp_dev *dev, struct comp_buffer *sink,
 	struct comp_data *cd = comp_get_drvdata(dev);
 	int32_t sine_sample;
 	int32_t *dest = (int32_t*) sink->w_ptr;
-	int i, n, n_wrap_dest;
 	int nch = cd->channels;
+	uint32_t frame_bytes = nch * sizeof(int32_t);
+	uint32_t n;
+	int i;
+
+	while (frames > 0) {
+		/* generate linear frames up to the buffer wrap */
+		n = buffer_linear_frames(sink, dest, frame_bytes);
+		if (n > frames)
+			n = frames;
+		if (n == 0) {
+			trace_tone_error("eLf");
+			return;
+		}
+		frames -= n;
 
-	n = frames * nch;
-	while (n > 0) {
-		n_wrap_dest = (int32_t *) sink->end_addr - dest;
-		if (n < n_wrap_dest) {
-			/* No circular wrap need */
-			while (n > 0) {
-				/* Update period count for sweeps, etc. */
-				tonegen_control(&cd->sg);
-				/* Calculate mono sine wave sample and then
-				 * duplicate to channels.
-				 */
-				sine_sample = tonegen(&cd->sg);
-				n -= nch;
-				for (i = 0; i < nch; i++) {
-					*dest = sine_sample;
-					dest++;
-				}
-			}
-		} else {
-			/* Process until wrap */
-			while (n_wrap_dest > 0) {
-				tonegen_control(&cd->sg);
-				sine_sample = tonegen(&cd->sg);
-				n -= nch;
-				n_wrap_dest -= nch;
-				for (i = 0; i < nch; i++) {
-					*dest = sine_sample;
-					dest++;
-				}
-			}
-			/* No need to check if past end_addr,
-			 * it is so just subtract buffer size.
+		while (n > 0) {
+			/* Update period count for sweeps, etc. */
+			tonegen_control(&cd->sg);
+			/* Calculate mono sine wave sample and then
+			 * duplicate to channels.
 			 */
-			dest = (int32_t *) ((size_t) dest
-				- sink->ipc_buffer.size);
+			sine_sample = tonegen(&cd->sg);
+			for (i = 0; i < nch; i++) {
+				*dest = sine_sample;
+				dest++;
+			}
+			n--;
 		}
+
+		dest = buffer_wrap_ptr(sink, dest);
 	}
-	sink->w_ptr = dest;
 }
 
 static int32_t tonegen(struct tone_state *sg)
@@ -428,6 +419,10 @@ static int tone_params(struct comp_dev *dev)
 	if (config->frame_fmt != SOF_IPC_FRAME_S32_LE)
 		return -EINVAL;
 
+	/* sine index, interpolation, amplitude and phase step once per frame
+	 * then a store per channel */
+	dev->cycles = (4 + dev->params.channels) * PLATFORM_MAC_COST;
+
 	return 0;
 }
 
@@ -505,10 +500,10 @@ static int tone_copy(struct comp_dev *dev)
 	/* Test that sink has enough free frames. Then run once to maintain
 	 * low latency and steady load for tones.
 	 */
-	if (sink->free >= cd->period_bytes) {
+	if (comp_buffer_get_free(sink) >= cd->period_bytes) {
 		/* create tone */
 		cd->tone_func(dev, sink, source, dev->frames);
-		comp_update_buffer_produce(sink, 0);
+		comp_update_buffer_produce(sink, cd->period_bytes);
 	}
 
 	return dev->frames;
@@ -518,6 +513,7 @@ static int tone_prepare(struct comp_dev *dev)
 {
 	int32_t f, a;
 	struct comp_data *cd = comp_get_drvdata(dev);
+	struct comp_buffer *sink;
 
 	trace_tone("TPp");
 
@@ -531,6 +527,14 @@ static int tone_prepare(struct comp_dev *dev)
 	if (tonegen_init(&cd->sg, cd->rate, f, a) < 0)
 		return -EINVAL;
 
+	/* frames must never be split by the buffer wrap */
+	sink = list_first_item(&dev->bsink_list, struct comp_buffer,
+		source_list);
+	if (!buffer_frames_aligned(sink, cd->channels * sizeof(int32_t))) {
+		trace_tone_error("eFa");
+		return -EINVAL;
+	}
+
 	dev->state = COMP_STATE_PREPARE;
 	return 0;
 }
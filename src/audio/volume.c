@@ -37,45 +37,69 @@
 #include <reef/list.h>
 #include <reef/stream.h>
 #include <reef/alloc.h>
-#include <reef/work.h>
 #include <reef/clock.h>
 #include <reef/audio/component.h>
+#include <reef/audio/format.h>
 #include <reef/audio/pipeline.h>
 
 #define trace_volume(__e)	trace_event(TRACE_CLASS_VOLUME, __e)
 #define tracev_volume(__e)	tracev_event(TRACE_CLASS_VOLUME, __e)
 #define trace_volume_error(__e)	trace_error(TRACE_CLASS_VOLUME, __e)
 
-/* this should ramp from 0dB to mute in 64ms.
- * i.e 2^16 -> 0 in 32 * 2048 steps each lasting 2ms
- */
-#define VOL_RAMP_US	2000
-#define VOL_RAMP_STEP	(1 << 11)
+/* default volume ramp duration if topology does not set one */
+#define VOL_RAMP_MS	64
 #define VOL_MAX		(1 << 16)
 
+/* ramp gains carry extra fractional bits so small steps don't round away */
+#define VOL_RAMP_SHIFT	8
+#define VOL_GAIN(v)	((v) >> VOL_RAMP_SHIFT)
+
+/* TPDF dither when the sink format is narrower than the source format */
+#define VOL_DITHER	1
+#define VOL_DITHER_SEED	0x12345678
+
 /*
  * Simple volume control
  *
  * Gain amplitude value is between 0 (mute) ... 2^16 (0dB) ... 2^24 (~+48dB)
  *
- * Currently we use 16 bit data for copies to/from DAIs and HOST PCM buffers,
- * 32 bit data is used in all other cases for overhead.
- * TODO: Add 24 bit (4 byte aligned) support using HiFi2 EP SIMD.
+ * Gain changes are ramped linearly per frame inside the volume kernels over
+ * the ramp duration, the copy splits processing at the end of the ramp so the
+ * final gain is exactly the target. Outside of a ramp all muted channels are
+ * zeroed and unity gain with matching formats is a plain copy.
+ *
+ * Samples are scaled as Q1.15, Q1.23 or Q1.31 by a Q16 gain with rounding and
+ * saturation to the sink format. Narrowing conversions add TPDF dither before
+ * rounding. Kernels run over whole linear blocks of frames with all channel
+ * gains held in registers so the inner loop maps onto the dual MAC units.
  */
 
 /* volume component private data */
 struct comp_data {
 	uint32_t source_period_bytes;
 	uint32_t sink_period_bytes;
+	uint32_t source_frame_bytes;
+	uint32_t sink_frame_bytes;
 	enum sof_ipc_frame source_format;
 	enum sof_ipc_frame sink_format;
 	uint32_t chan[SOF_IPC_MAX_CHANNELS];
 	uint32_t volume[SOF_IPC_MAX_CHANNELS];	/* current volume */
 	uint32_t tvolume[SOF_IPC_MAX_CHANNELS];	/* target volume */
 	uint32_t mvolume[SOF_IPC_MAX_CHANNELS];	/* mute volume */
-	void (*scale_vol)(struct comp_dev *dev, struct comp_buffer *sink,
-		struct comp_buffer *source, uint32_t frames);
-	struct work volwork;
+	uint32_t rvolume[SOF_IPC_MAX_CHANNELS];	/* ramp target volume */
+	uint32_t channels;
+	void (*scale_vol)(struct comp_dev *dev, void *sink,
+		void *source, uint32_t frames);	/* current kernel */
+	void (*mult_vol)(struct comp_dev *dev, void *sink,
+		void *source, uint32_t frames);	/* format gain kernel */
+
+	/* ramp state - only changed in copy context */
+	int32_t ramp_vol[SOF_IPC_MAX_CHANNELS];	/* gain << VOL_RAMP_SHIFT */
+	int32_t ramp_inc[SOF_IPC_MAX_CHANNELS];	/* ramp_vol step per frame */
+	uint32_t ramp_frames;		/* frames left in ramp */
+	uint32_t ramp_ms;		/* ramp duration */
+	uint32_t ramp_pending;		/* new target volume set */
+	uint32_t dither_seed;		/* dither LCG state */
 
 	/* host volume readback */
 	struct sof_ipc_ctrl_value_chan *hvol;
@@ -84,146 +108,451 @@ struct comp_data {
 struct comp_func_map {
 	uint16_t source;	/* source format */
 	uint16_t sink;		/* sink format */
-	uint16_t channels;	/* channel number for the stream */
-	void (*func)(struct comp_dev *dev, struct comp_buffer *sink,
-		struct comp_buffer *source, uint32_t frames);
+	void (*func)(struct comp_dev *dev, void *sink,
+		void *source, uint32_t frames);
+	void (*dither_func)(struct comp_dev *dev, void *sink,
+		void *source, uint32_t frames);	/* narrowing only */
 };
 
+/*
+ * Call kernel with a constant channel count for the common stream layouts so
+ * the compiler can unroll the channel loop and keep gains in registers. Other
+ * channel counts use the generic loop.
+ */
+#if PLATFORM_MAX_CHANNELS >= 8
+#define VOL_CASE_8CH(kernel, cd, sink, source, frames) \
+	case 8: \
+		kernel(cd, sink, source, frames, 8); \
+		break;
+#else
+#define VOL_CASE_8CH(kernel, cd, sink, source, frames)
+#endif
+
+#define VOL_CHANNELS(kernel, cd, sink, source, frames) \
+	do { \
+		switch (cd->channels) { \
+		case 1: \
+			kernel(cd, sink, source, frames, 1); \
+			break; \
+		case 2: \
+			kernel(cd, sink, source, frames, 2); \
+			break; \
+		case 4: \
+			kernel(cd, sink, source, frames, 4); \
+			break; \
+		VOL_CASE_8CH(kernel, cd, sink, source, frames) \
+		default: \
+			kernel(cd, sink, source, frames, cd->channels); \
+			break; \
+		} \
+	} while (0)
+
+/*
+ * TPDF dither of +/- 1 LSB after discarding bits of precision, made from the
+ * difference of two uniform random values from a simple LCG.
+ */
+static inline int64_t vol_tpdf(uint32_t *seed, const int bits)
+{
+	uint32_t r1, r2;
+
+	r1 = *seed = *seed * 1664525 + 1013904223;
+	r2 = *seed = *seed * 1664525 + 1013904223;
+
+	return (int64_t)(r1 >> (32 - bits)) - (int64_t)(r2 >> (32 - bits));
+}
+
 /* copy and scale volume from 16 bit source buffer to 32 bit dest buffer */
-static void vol_s16_to_s32(struct comp_dev *dev, struct comp_buffer *sink,
-	struct comp_buffer *source, uint32_t frames)
+static inline void vol_s16_to_s32_ch(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch)
+{
+	int16_t *src = (int16_t *)source;
+	int32_t *dest = (int32_t *)sink;
+	int32_t vol[PLATFORM_MAX_CHANNELS];
+	uint32_t i, c;
+	int64_t p;
+
+	for (c = 0; c < nch; c++)
+		vol[c] = cd->ramp_vol[c];
+
+	/* source and sink frames are contiguous */
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < nch; c++) {
+			p = (int64_t)src[c] * VOL_GAIN(vol[c]);
+			dest[c] = sat_int32(p);
+			vol[c] += cd->ramp_inc[c];
+		}
+		src += nch;
+		dest += nch;
+	}
+
+	for (c = 0; c < nch; c++)
+		cd->ramp_vol[c] = vol[c];
+}
+
+static void vol_s16_to_s32(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
-	int16_t *src = (int16_t*) source->r_ptr;
-	int32_t i, *dest = (int32_t*) sink->w_ptr;
 
-	/* buffer sizes are always divisible by period frames */
-	for (i = 0; i < frames * 2; i += 2) {
-		dest[i] = (int32_t)src[i] * cd->volume[0];
-		dest[i + 1] = (int32_t)src[i + 1] * cd->volume[1];
+	VOL_CHANNELS(vol_s16_to_s32_ch, cd, sink, source, frames);
+}
+
+/* copy and scale volume from 32 bit source buffer to 16 bit dest buffer, with optional dither */
+static inline void vol_s32_to_s16_blk(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch, const int dither)
+{
+	int32_t *src = (int32_t *)source;
+	int16_t *dest = (int16_t *)sink;
+	int32_t vol[PLATFORM_MAX_CHANNELS];
+	uint32_t seed = cd->dither_seed;
+	uint32_t i, c;
+	int64_t p;
+
+	for (c = 0; c < nch; c++)
+		vol[c] = cd->ramp_vol[c];
+
+	/* source and sink frames are contiguous */
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < nch; c++) {
+			p = (int64_t)src[c] * VOL_GAIN(vol[c]);
+			if (dither)
+				p += vol_tpdf(&seed, 32);
+			dest[c] = sat_int16(Q_SHIFT_RND(p, 47, 15));
+			vol[c] += cd->ramp_inc[c];
+		}
+		src += nch;
+		dest += nch;
 	}
+
+	for (c = 0; c < nch; c++)
+		cd->ramp_vol[c] = vol[c];
+	cd->dither_seed = seed;
+}
+
+static inline void vol_s32_to_s16_ch(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch)
+{
+	vol_s32_to_s16_blk(cd, sink, source, frames, nch, 0);
+}
+
+static inline void vol_s32_to_s16_dither_ch(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch)
+{
+	vol_s32_to_s16_blk(cd, sink, source, frames, nch, 1);
 }
 
-/* copy and scale volume from 32 bit source buffer to 16 bit dest buffer */
-static void vol_s32_to_s16(struct comp_dev *dev, struct comp_buffer *sink,
-	struct comp_buffer *source, uint32_t frames)
+static void vol_s32_to_s16(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
-	int32_t i, *src = (int32_t*) source->r_ptr;
-	int16_t *dest = (int16_t*) sink->w_ptr;
 
-	/* buffer sizes are always divisible by period frames */
-	for (i = 0; i < frames * 2; i += 2) {
-		dest[i] = (((int32_t)src[i] >> 16) * cd->volume[0]) >> 16;
-		dest[i + 1] = (((int32_t)src[i + 1] >> 16) * cd->volume[1]) >> 16;
-	}
+	VOL_CHANNELS(vol_s32_to_s16_ch, cd, sink, source, frames);
 }
 
-/* copy and scale volume from 32 bit source buffer to 32 bit dest buffer */
-static void vol_s32_to_s32(struct comp_dev *dev, struct comp_buffer *sink,
-	struct comp_buffer *source, uint32_t frames)
+static void vol_s32_to_s16_dither(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
-	int32_t *src = (int32_t*) source->r_ptr;
-	int32_t i, *dest = (int32_t*) sink->w_ptr;
 
-	/* buffer sizes are always divisible by period frames */
-	for (i = 0; i < frames * 2; i += 2) {
-		dest[i] = ((int64_t)src[i] * cd->volume[0]) >> 16;
-		dest[i + 1] = ((int64_t)src[i + 1] * cd->volume[1]) >> 16;
+	VOL_CHANNELS(vol_s32_to_s16_dither_ch, cd, sink, source, frames);
+}
+
+/* copy and scale volume from 32 bit source buffer to 32 bit dest buffer */
+static inline void vol_s32_to_s32_ch(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch)
+{
+	int32_t *src = (int32_t *)source;
+	int32_t *dest = (int32_t *)sink;
+	int32_t vol[PLATFORM_MAX_CHANNELS];
+	uint32_t i, c;
+	int64_t p;
+
+	for (c = 0; c < nch; c++)
+		vol[c] = cd->ramp_vol[c];
+
+	/* source and sink frames are contiguous */
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < nch; c++) {
+			p = (int64_t)src[c] * VOL_GAIN(vol[c]);
+			dest[c] = sat_int32(Q_SHIFT_RND(p, 47, 31));
+			vol[c] += cd->ramp_inc[c];
+		}
+		src += nch;
+		dest += nch;
 	}
+
+	for (c = 0; c < nch; c++)
+		cd->ramp_vol[c] = vol[c];
 }
 
-/* copy and scale volume from 16 bit source buffer to 16 bit dest buffer */
-static void vol_s16_to_s16(struct comp_dev *dev, struct comp_buffer *sink,
-	struct comp_buffer *source, uint32_t frames)
+static void vol_s32_to_s32(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
-	int16_t *src = (int16_t*) source->r_ptr;
-	int16_t *dest = (int16_t*) sink->w_ptr;
-	int32_t i;
-
-	/* buffer sizes are always divisible by period frames */
-	for (i = 0; i < frames * 2; i += 2) {
-		dest[i] = ((int32_t)src[i] * cd->volume[0]) >> 16;
-		dest[i + 1] = ((int32_t)src[i + 1] * cd->volume[1]) >> 16;
+
+	VOL_CHANNELS(vol_s32_to_s32_ch, cd, sink, source, frames);
+}
+
+/* copy and scale volume from 16 bit source buffer to 16 bit dest buffer */
+static inline void vol_s16_to_s16_ch(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch)
+{
+	int16_t *src = (int16_t *)source;
+	int16_t *dest = (int16_t *)sink;
+	int32_t vol[PLATFORM_MAX_CHANNELS];
+	uint32_t i, c;
+	int32_t p;
+
+	for (c = 0; c < nch; c++)
+		vol[c] = cd->ramp_vol[c];
+
+	/* source and sink frames are contiguous */
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < nch; c++) {
+			p = (int32_t)src[c] * VOL_GAIN(vol[c]);
+			dest[c] = sat_int16(Q_SHIFT_RND(p, 31, 15));
+			vol[c] += cd->ramp_inc[c];
+		}
+		src += nch;
+		dest += nch;
 	}
+
+	for (c = 0; c < nch; c++)
+		cd->ramp_vol[c] = vol[c];
 }
 
-/* copy and scale volume from 16 bit source buffer to 24 bit on 32 bit boundary dest buffer */
-static void vol_s16_to_s24(struct comp_dev *dev, struct comp_buffer *sink,
-	struct comp_buffer *source, uint32_t frames)
+static void vol_s16_to_s16(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
-	int16_t *src = (int16_t*) source->r_ptr;
-	int32_t i, *dest = (int32_t*) sink->w_ptr;
 
-	/* buffer sizes are always divisible by period frames */
-	for (i = 0; i < frames * 2; i += 2) {
-		dest[i] = ((int32_t)src[i] * cd->volume[0]) >> 8;
-		dest[i + 1] = ((int32_t)src[i + 1] * cd->volume[1]) >> 8;
-	}
+	VOL_CHANNELS(vol_s16_to_s16_ch, cd, sink, source, frames);
 }
 
 /* copy and scale volume from 16 bit source buffer to 24 bit on 32 bit boundary dest buffer */
-static void vol_s24_to_s16(struct comp_dev *dev, struct comp_buffer *sink,
-	struct comp_buffer *source, uint32_t frames)
+static inline void vol_s16_to_s24_ch(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch)
+{
+	int16_t *src = (int16_t *)source;
+	int32_t *dest = (int32_t *)sink;
+	int32_t vol[PLATFORM_MAX_CHANNELS];
+	uint32_t i, c;
+	int32_t p;
+
+	for (c = 0; c < nch; c++)
+		vol[c] = cd->ramp_vol[c];
+
+	/* source and sink frames are contiguous */
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < nch; c++) {
+			p = (int32_t)src[c] * VOL_GAIN(vol[c]);
+			dest[c] = sat_int24(Q_SHIFT_RND(p, 31, 23));
+			vol[c] += cd->ramp_inc[c];
+		}
+		src += nch;
+		dest += nch;
+	}
+
+	for (c = 0; c < nch; c++)
+		cd->ramp_vol[c] = vol[c];
+}
+
+static void vol_s16_to_s24(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
-	int32_t i, *src = (int32_t*) source->r_ptr;
-	int16_t *dest = (int16_t*) sink->w_ptr;
-
-	/* buffer sizes are always divisible by period frames */
-	for (i = 0; i < frames * 2; i += 2) {
-		dest[i] = (int16_t)((((int32_t)src[i] >> 8) *
-			cd->volume[0]) >> 16);
-		dest[i + 1] = (int16_t)((((int32_t)src[i + 1] >> 8) *
-			cd->volume[1]) >> 16);
+
+	VOL_CHANNELS(vol_s16_to_s24_ch, cd, sink, source, frames);
+}
+
+/* copy and scale volume from 24 bit on 32 bit boundary source buffer to 16 bit dest buffer, with optional dither */
+static inline void vol_s24_to_s16_blk(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch, const int dither)
+{
+	int32_t *src = (int32_t *)source;
+	int16_t *dest = (int16_t *)sink;
+	int32_t vol[PLATFORM_MAX_CHANNELS];
+	uint32_t seed = cd->dither_seed;
+	uint32_t i, c;
+	int64_t p;
+
+	for (c = 0; c < nch; c++)
+		vol[c] = cd->ramp_vol[c];
+
+	/* source and sink frames are contiguous */
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < nch; c++) {
+			p = (int64_t)src[c] * VOL_GAIN(vol[c]);
+			if (dither)
+				p += vol_tpdf(&seed, 24);
+			dest[c] = sat_int16(Q_SHIFT_RND(p, 39, 15));
+			vol[c] += cd->ramp_inc[c];
+		}
+		src += nch;
+		dest += nch;
 	}
+
+	for (c = 0; c < nch; c++)
+		cd->ramp_vol[c] = vol[c];
+	cd->dither_seed = seed;
+}
+
+static inline void vol_s24_to_s16_ch(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch)
+{
+	vol_s24_to_s16_blk(cd, sink, source, frames, nch, 0);
+}
+
+static inline void vol_s24_to_s16_dither_ch(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch)
+{
+	vol_s24_to_s16_blk(cd, sink, source, frames, nch, 1);
+}
+
+static void vol_s24_to_s16(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
+{
+	struct comp_data *cd = comp_get_drvdata(dev);
+
+	VOL_CHANNELS(vol_s24_to_s16_ch, cd, sink, source, frames);
 }
 
-/* copy and scale volume from 32 bit source buffer to 24 bit on 32 bit boundary dest buffer */
-static void vol_s32_to_s24(struct comp_dev *dev, struct comp_buffer *sink,
-	struct comp_buffer *source, uint32_t frames)
+static void vol_s24_to_s16_dither(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
-	int32_t *src = (int32_t*) source->r_ptr;
-	int32_t i, *dest = (int32_t*) sink->w_ptr;
 
-	/* buffer sizes are always divisible by period frames */
-	for (i = 0; i < frames * 2; i += 2) {
-		dest[i] = ((int64_t)src[i] * cd->volume[0]) >> 24;
-		dest[i + 1] = ((int64_t)src[i + 1] * cd->volume[1]) >> 24;
+	VOL_CHANNELS(vol_s24_to_s16_dither_ch, cd, sink, source, frames);
+}
+
+/* copy and scale volume from 32 bit source buffer to 24 bit on 32 bit boundary dest buffer, with optional dither */
+static inline void vol_s32_to_s24_blk(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch, const int dither)
+{
+	int32_t *src = (int32_t *)source;
+	int32_t *dest = (int32_t *)sink;
+	int32_t vol[PLATFORM_MAX_CHANNELS];
+	uint32_t seed = cd->dither_seed;
+	uint32_t i, c;
+	int64_t p;
+
+	for (c = 0; c < nch; c++)
+		vol[c] = cd->ramp_vol[c];
+
+	/* source and sink frames are contiguous */
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < nch; c++) {
+			p = (int64_t)src[c] * VOL_GAIN(vol[c]);
+			if (dither)
+				p += vol_tpdf(&seed, 24);
+			dest[c] = sat_int24(Q_SHIFT_RND(p, 47, 23));
+			vol[c] += cd->ramp_inc[c];
+		}
+		src += nch;
+		dest += nch;
 	}
+
+	for (c = 0; c < nch; c++)
+		cd->ramp_vol[c] = vol[c];
+	cd->dither_seed = seed;
 }
 
-/* copy and scale volume from 16 bit source buffer to 24 bit on 32 bit boundary dest buffer */
-static void vol_s24_to_s32(struct comp_dev *dev, struct comp_buffer *sink,
-	struct comp_buffer *source, uint32_t frames)
+static inline void vol_s32_to_s24_ch(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch)
+{
+	vol_s32_to_s24_blk(cd, sink, source, frames, nch, 0);
+}
+
+static inline void vol_s32_to_s24_dither_ch(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch)
+{
+	vol_s32_to_s24_blk(cd, sink, source, frames, nch, 1);
+}
+
+static void vol_s32_to_s24(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
+{
+	struct comp_data *cd = comp_get_drvdata(dev);
+
+	VOL_CHANNELS(vol_s32_to_s24_ch, cd, sink, source, frames);
+}
+
+static void vol_s32_to_s24_dither(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
-	int32_t i, *src = (int32_t*) source->r_ptr;
-	int32_t *dest = (int32_t*) sink->w_ptr;
-
-	/* buffer sizes are always divisible by period frames */
-	for (i = 0; i < frames * 2; i += 2) {
-		dest[i] = (int32_t)(((int64_t)src[i]  *
-			cd->volume[0]) >> 8);
-		dest[i + 1] = (int32_t)(((int64_t)src[i + 1] *
-			cd->volume[1]) >> 8);
+
+	VOL_CHANNELS(vol_s32_to_s24_dither_ch, cd, sink, source, frames);
+}
+
+/* copy and scale volume from 24 bit on 32 bit boundary source buffer to 32 bit dest buffer */
+static inline void vol_s24_to_s32_ch(struct comp_data *cd, void *sink,
+	void *source, uint32_t frames, const uint32_t nch)
+{
+	int32_t *src = (int32_t *)source;
+	int32_t *dest = (int32_t *)sink;
+	int32_t vol[PLATFORM_MAX_CHANNELS];
+	uint32_t i, c;
+	int64_t p;
+
+	for (c = 0; c < nch; c++)
+		vol[c] = cd->ramp_vol[c];
+
+	/* source and sink frames are contiguous */
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < nch; c++) {
+			p = (int64_t)src[c] * VOL_GAIN(vol[c]);
+			dest[c] = sat_int32(Q_SHIFT_RND(p, 39, 31));
+			vol[c] += cd->ramp_inc[c];
+		}
+		src += nch;
+		dest += nch;
 	}
+
+	for (c = 0; c < nch; c++)
+		cd->ramp_vol[c] = vol[c];
+}
+
+static void vol_s24_to_s32(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
+{
+	struct comp_data *cd = comp_get_drvdata(dev);
+
+	VOL_CHANNELS(vol_s24_to_s32_ch, cd, sink, source, frames);
+}
+
+/* unity gain on all channels - copy source to sink unless in place */
+static void vol_copy(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
+{
+	struct comp_data *cd = comp_get_drvdata(dev);
+
+	if (sink != source)
+		memcpy(sink, source, frames * cd->sink_frame_bytes);
+}
+
+/* all channels muted - zero sink */
+static void vol_mute(struct comp_dev *dev, void *sink,
+	void *source, uint32_t frames)
+{
+	struct comp_data *cd = comp_get_drvdata(dev);
+
+	bzero(sink, frames * cd->sink_frame_bytes);
 }
 
 /* map of source and sink buffer formats to volume function */
 static const struct comp_func_map func_map[] = {
-	{SOF_IPC_FRAME_S16_LE, SOF_IPC_FRAME_S16_LE, 2, vol_s16_to_s16},
-	{SOF_IPC_FRAME_S16_LE, SOF_IPC_FRAME_S32_LE, 2, vol_s16_to_s32},
-	{SOF_IPC_FRAME_S32_LE, SOF_IPC_FRAME_S16_LE, 2, vol_s32_to_s16},
-	{SOF_IPC_FRAME_S32_LE, SOF_IPC_FRAME_S32_LE, 2, vol_s32_to_s32},
-	{SOF_IPC_FRAME_S16_LE, SOF_IPC_FRAME_S24_4LE, 2, vol_s16_to_s24},
-	{SOF_IPC_FRAME_S24_4LE, SOF_IPC_FRAME_S16_LE, 2, vol_s24_to_s16},
-	{SOF_IPC_FRAME_S32_LE, SOF_IPC_FRAME_S24_4LE, 2, vol_s32_to_s24},
-	{SOF_IPC_FRAME_S24_4LE, SOF_IPC_FRAME_S32_LE, 2, vol_s24_to_s32},
+	{SOF_IPC_FRAME_S16_LE, SOF_IPC_FRAME_S16_LE, vol_s16_to_s16, NULL},
+	{SOF_IPC_FRAME_S16_LE, SOF_IPC_FRAME_S32_LE, vol_s16_to_s32, NULL},
+	{SOF_IPC_FRAME_S32_LE, SOF_IPC_FRAME_S16_LE, vol_s32_to_s16,
+		vol_s32_to_s16_dither},
+	{SOF_IPC_FRAME_S32_LE, SOF_IPC_FRAME_S32_LE, vol_s32_to_s32, NULL},
+	{SOF_IPC_FRAME_S16_LE, SOF_IPC_FRAME_S24_4LE, vol_s16_to_s24, NULL},
+	{SOF_IPC_FRAME_S24_4LE, SOF_IPC_FRAME_S16_LE, vol_s24_to_s16,
+		vol_s24_to_s16_dither},
+	{SOF_IPC_FRAME_S32_LE, SOF_IPC_FRAME_S24_4LE, vol_s32_to_s24,
+		vol_s32_to_s24_dither},
+	{SOF_IPC_FRAME_S24_4LE, SOF_IPC_FRAME_S32_LE, vol_s24_to_s32, NULL},
 };
 
 /* synchronise host mmap() volume with real value */
@@ -240,63 +569,87 @@ static void vol_sync_host(struct comp_data *cd, uint32_t chan)
 	}
 }
 
-static void vol_update(struct comp_data *cd, uint32_t chan)
+/* set gain to volume with no ramp */
+static void vol_set(struct comp_data *cd, int chan, uint32_t vol)
 {
-	cd->volume[chan] = cd->tvolume[chan];
+	cd->volume[chan] = vol;
+	cd->ramp_vol[chan] = vol << VOL_RAMP_SHIFT;
+	cd->ramp_inc[chan] = 0;
 	vol_sync_host(cd, chan);
 }
 
-/* this ramps volume changes over time */
-static uint32_t vol_work(void *data, uint32_t delay)
+/* select cheapest kernel for the current static gain */
+static void vol_select_func(struct comp_data *cd)
 {
-	struct comp_dev *dev = (struct comp_dev *)data;
-	struct comp_data *cd = comp_get_drvdata(dev);
-	uint32_t vol;
-	int i, again = 0;
+	uint32_t unity = 1, mute = 1;
+	int i;
 
-	/* inc/dec each volume if it's not at target */
-	for (i = 0; i < PLATFORM_MAX_CHANNELS; i++) {
+	for (i = 0; i < cd->channels; i++) {
+		if (cd->volume[i] != VOL_MAX)
+			unity = 0;
+		if (cd->volume[i] != 0)
+			mute = 0;
+	}
 
-		/* skip if target reached */
-		if (cd->volume[i] == cd->tvolume[i]) {
-			continue;
-		}
+	if (mute)
+		cd->scale_vol = vol_mute;
+	else if (unity && cd->source_format == cd->sink_format)
+		cd->scale_vol = vol_copy;
+	else
+		cd->scale_vol = cd->mult_vol;
+}
+
+/* ramp completed - land exactly on the ramp target volume */
+static void vol_ramp_complete(struct comp_data *cd)
+{
+	int i;
 
-		vol = cd->volume[i];
+	for (i = 0; i < PLATFORM_MAX_CHANNELS; i++)
+		vol_set(cd, i, cd->rvolume[i]);
 
-		if (cd->volume[i] < cd->tvolume[i]) {
-			/* ramp up */
-			vol += VOL_RAMP_STEP;
+	cd->ramp_frames = 0;
+	vol_select_func(cd);
+}
 
-			/* ramp completed ? */
-			if (vol >= cd->tvolume[i] || vol >= VOL_MAX)
-				vol_update(cd, i);
-			else {
-				cd->volume[i] = vol;
-				again = 1;
-			}
-		} else {
-			/* ramp down */
-			vol -= VOL_RAMP_STEP;
-
-			/* ramp completed ? */
-			if (vol <= cd->tvolume[i] || vol >= VOL_MAX)
-				vol_update(cd, i);
-			else {
-				cd->volume[i] = vol;
-				again = 1;
-			}
-		}
+/* start ramping from current gain to new target volume */
+static void vol_ramp_start(struct comp_dev *dev)
+{
+	struct comp_data *cd = comp_get_drvdata(dev);
+	uint32_t frames;
+	int i;
+
+	WRITE_ONCE(cd->ramp_pending, 0);
 
-		/* sync host with new value */
-		vol_sync_host(cd, i);
+	frames = dev->params.rate * cd->ramp_ms / 1000;
+
+	for (i = 0; i < PLATFORM_MAX_CHANNELS; i++) {
+		cd->rvolume[i] = READ_ONCE(cd->tvolume[i]);
+		if (frames > 0)
+			cd->ramp_inc[i] = ((int32_t)(cd->rvolume[i] <<
+				VOL_RAMP_SHIFT) - cd->ramp_vol[i]) /
+				(int32_t)frames;
 	}
 
-	/* do we need to continue ramping */
-	if (again)
-		return VOL_RAMP_US;
+	cd->ramp_frames = frames;
+	if (frames == 0)
+		vol_ramp_complete(cd);
 	else
-		return 0;
+		cd->scale_vol = cd->mult_vol;
+}
+
+/* update current volume as seen by host during a ramp */
+static void vol_ramp_update(struct comp_data *cd, uint32_t frames)
+{
+	int i;
+
+	cd->ramp_frames -= frames;
+	if (cd->ramp_frames == 0) {
+		vol_ramp_complete(cd);
+		return;
+	}
+
+	for (i = 0; i < PLATFORM_MAX_CHANNELS; i++)
+		cd->volume[i] = VOL_GAIN(cd->ramp_vol[i]);
 }
 
 static struct comp_dev *volume_new(struct sof_ipc_comp *comp)
@@ -324,12 +677,15 @@ static struct comp_dev *volume_new(struct sof_ipc_comp *comp)
 	}
 
 	comp_set_drvdata(dev, cd);
-	work_init(&cd->volwork, vol_work, dev, WORK_ASYNC);
+
+	/* ramp duration from topology */
+	cd->ramp_ms = ipc_vol->initial_ramp ? ipc_vol->initial_ramp :
+		VOL_RAMP_MS;
 
 	/* set the default volumes */
 	for (i = 0; i < PLATFORM_MAX_CHANNELS; i++) {
-		cd->volume[i] = VOL_MAX;
 		cd->tvolume[i] = VOL_MAX;
+		vol_set(cd, i, VOL_MAX);
 	}
 
 	dev->state = COMP_STATE_READY;
@@ -354,6 +710,9 @@ static int volume_params(struct comp_dev *dev)
 {
 	trace_volume("par");
 
+	/* one gain multiply per sample */
+	dev->cycles = dev->params.channels * PLATFORM_MAC_COST;
+
 	return 0;
 }
 
@@ -370,7 +729,7 @@ static inline void volume_set_chan_mute(struct comp_dev *dev, int chan)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
 
-	cd->mvolume[chan] = cd->volume[chan];
+	cd->mvolume[chan] = cd->tvolume[chan];
 	cd->tvolume[chan] = 0;
 }
 
@@ -387,7 +746,7 @@ static int volume_ctrl_set_cmd(struct comp_dev *dev, struct sof_ipc_ctrl_data *c
 	int i, j;
 
 	/* validate */
-	if (cdata->num_elems == 0 || cdata->num_elems >= SOF_IPC_MAX_CHANNELS) {
+	if (cdata->num_elems == 0 || cdata->num_elems > SOF_IPC_MAX_CHANNELS) {
 		trace_volume_error("gs0");
 		return -EINVAL;
 	}
@@ -397,38 +756,37 @@ static int volume_ctrl_set_cmd(struct comp_dev *dev, struct sof_ipc_ctrl_data *c
 
 		for (i = 0; i < SOF_IPC_MAX_CHANNELS; i++) {
 			for (j = 0; j < cdata->num_elems; j++) {
-				if (cdata->chanv[j].value == cd->chan[i])
+				if (cdata->chanv[j].channel == cd->chan[i])
 					volume_set_chan(dev, i, cdata->chanv[j].value);
 			}
 		}
 
-		work_schedule_default(&cd->volwork, VOL_RAMP_US);
 		break;
 	case SOF_CTRL_CMD_MUTE:
 
 		for (i = 0; i < SOF_IPC_MAX_CHANNELS; i++) {
 			for (j = 0; j < cdata->num_elems; j++) {
-				if (cdata->chanv[j].value == cd->chan[i])
+				if (cdata->chanv[j].channel == cd->chan[i])
 					volume_set_chan_mute(dev, i);
 			}
 		}
-		work_schedule_default(&cd->volwork, VOL_RAMP_US);
 		break;
 	case SOF_CTRL_CMD_UNMUTE:
 
 		for (i = 0; i < SOF_IPC_MAX_CHANNELS; i++) {
 			for (j = 0; j < cdata->num_elems; j++) {
-				if (cdata->chanv[j].value == cd->chan[i])
+				if (cdata->chanv[j].channel == cd->chan[i])
 					volume_set_chan_unmute(dev, i);
 			}
 		}
-		work_schedule_default(&cd->volwork, VOL_RAMP_US);
 		break;
 	default:
 		trace_volume_error("gs1");
 		return -EINVAL;
 	}
 
+	/* ramp to new volume from next copy */
+	WRITE_ONCE(cd->ramp_pending, 1);
 	return 0;
 }
 
@@ -438,7 +796,7 @@ static int volume_ctrl_get_cmd(struct comp_dev *dev, struct sof_ipc_ctrl_data *c
 	int i, j;
 
 	/* validate */
-	if (cdata->num_elems == 0 || cdata->num_elems >= SOF_IPC_MAX_CHANNELS) {
+	if (cdata->num_elems == 0 || cdata->num_elems > SOF_IPC_MAX_CHANNELS) {
 		trace_volume_error("gc0");
 		return -EINVAL;
 	}
@@ -446,9 +804,9 @@ static int volume_ctrl_get_cmd(struct comp_dev *dev, struct sof_ipc_ctrl_data *c
 	switch (cdata->cmd) {
 	case SOF_CTRL_CMD_VOLUME:
 
-		for (i = 0; i < cdata->num_elems; i++) {
+		for (i = 0; i < SOF_IPC_MAX_CHANNELS; i++) {
 			for (j = 0; j < cdata->num_elems; j++) {
-				if (cdata->chanv[j].value == cd->chan[i])
+				if (cdata->chanv[j].channel == cd->chan[i])
 					cdata->chanv[j].value = cd->tvolume[i];
 			}
 		}
@@ -489,7 +847,8 @@ static int volume_copy(struct comp_dev *dev)
 {
 	struct comp_data *cd = comp_get_drvdata(dev);
 	struct comp_buffer *sink, *source;
-	uint32_t copy_bytes;
+	uint32_t copy_bytes, frames, n;
+	void *src, *dest;
 
 	tracev_volume("cpy");
 
@@ -510,8 +869,36 @@ static int volume_copy(struct comp_dev *dev)
 		return 0;
 	}
 
-	/* copy and scale volume */
-	cd->scale_vol(dev, sink, source, dev->frames);
+	/* start ramp to any new volume */
+	if (READ_ONCE(cd->ramp_pending))
+		vol_ramp_start(dev);
+
+	/* copy and scale volume in linear chunks up to each buffer wrap and
+	 * the end of any ramp */
+	src = source->r_ptr;
+	dest = sink->w_ptr;
+	for (frames = dev->frames; frames > 0; frames -= n) {
+		n = buffer_linear_frames(source, src, cd->source_frame_bytes);
+		if (n > buffer_linear_frames(sink, dest, cd->sink_frame_bytes))
+			n = buffer_linear_frames(sink, dest,
+				cd->sink_frame_bytes);
+		if (n > frames)
+			n = frames;
+		if (n == 0) {
+			trace_volume_error("vc0");
+			return -EINVAL;
+		}
+		if (cd->ramp_frames > 0 && n > cd->ramp_frames)
+			n = cd->ramp_frames;
+
+		cd->scale_vol(dev, dest, src, n);
+
+		if (cd->ramp_frames > 0)
+			vol_ramp_update(cd, n);
+
+		src = buffer_wrap_ptr(source, src + n * cd->source_frame_bytes);
+		dest = buffer_wrap_ptr(sink, dest + n * cd->sink_frame_bytes);
+	}
 
 	/* calc new free and available */
 	comp_update_buffer_produce(sink, cd->sink_period_bytes);
@@ -543,8 +930,9 @@ static int volume_prepare(struct comp_dev *dev)
 	case SOF_COMP_SG_HOST:
 		/* source format comes from IPC params */
 		cd->source_format = sourceb->source->params.frame_fmt;
+		cd->source_frame_bytes = comp_frame_bytes(sourceb->source);
 		cd->source_period_bytes = dev->frames *
-			comp_frame_bytes(sourceb->source);
+			cd->source_frame_bytes;
 		break;
 	case SOF_COMP_DAI:
 	case SOF_COMP_SG_DAI:
@@ -552,8 +940,9 @@ static int volume_prepare(struct comp_dev *dev)
 		/* source format comes from DAI/comp config */
 		sconfig = COMP_GET_CONFIG(sourceb->source);
 		cd->source_format = sconfig->frame_fmt;
+		cd->source_frame_bytes = comp_frame_bytes(sourceb->source);
 		cd->source_period_bytes = dev->frames *
-			comp_frame_bytes(sourceb->source);
+			cd->source_frame_bytes;
 		break;
 	}
 
@@ -563,8 +952,9 @@ static int volume_prepare(struct comp_dev *dev)
 	case SOF_COMP_SG_HOST:
 		/* sink format come from IPC params */
 		cd->sink_format = sinkb->sink->params.frame_fmt;
+		cd->sink_frame_bytes = comp_frame_bytes(sinkb->sink);
 		cd->sink_period_bytes = dev->frames *
-			comp_frame_bytes(sinkb->sink);
+			cd->sink_frame_bytes;
 		break;
 	case SOF_COMP_DAI:
 	case SOF_COMP_SG_DAI:
@@ -572,8 +962,9 @@ static int volume_prepare(struct comp_dev *dev)
 		/* sink format comes from DAI/comp config */
 		sconfig = COMP_GET_CONFIG(sinkb->sink);
 		cd->sink_format = sconfig->frame_fmt;
+		cd->sink_frame_bytes = comp_frame_bytes(sinkb->sink);
 		cd->sink_period_bytes = dev->frames *
-			comp_frame_bytes(sinkb->sink);
+			cd->sink_frame_bytes;
 		break;
 	}
 
@@ -603,6 +994,23 @@ static int volume_prepare(struct comp_dev *dev)
 		return -EINVAL;
 	}
 
+	if (dev->params.channels == 0 ||
+		dev->params.channels > PLATFORM_MAX_CHANNELS) {
+		trace_volume_error("vp3");
+		trace_value(dev->params.channels);
+		return -EINVAL;
+	}
+	cd->channels = dev->params.channels;
+
+	/* frames must never be split by either buffer wrap */
+	if (!buffer_frames_aligned(sourceb, cd->source_frame_bytes) ||
+		!buffer_frames_aligned(sinkb, cd->sink_frame_bytes)) {
+		trace_volume_error("vp4");
+		trace_value(sourceb->size);
+		trace_value(sinkb->size);
+		return -EINVAL;
+	}
+
 	/* map the volume function for source and sink buffers */
 	for (i = 0; i < ARRAY_SIZE(func_map); i++) {
 
@@ -610,18 +1018,25 @@ static int volume_prepare(struct comp_dev *dev)
 			continue;
 		if (cd->sink_format != func_map[i].sink)
 			continue;
-		if (dev->params.channels != func_map[i].channels)
-			continue;
 
-		cd->scale_vol = func_map[i].func;
+		cd->mult_vol = func_map[i].func;
+		if (VOL_DITHER && func_map[i].dither_func)
+			cd->mult_vol = func_map[i].dither_func;
 		goto found;
 	}
 
 	return -EINVAL;
 
 found:
-	for (i = 0; i < PLATFORM_MAX_CHANNELS; i++)
-		vol_sync_host(cd, i);
+	cd->dither_seed = VOL_DITHER_SEED;
+
+	/* nothing has played yet, so start at target volume with no ramp */
+	WRITE_ONCE(cd->ramp_pending, 0);
+	for (i = 0; i < PLATFORM_MAX_CHANNELS; i++) {
+		cd->chan[i] = dev->params.chmap[i];
+		cd->rvolume[i] = READ_ONCE(cd->tvolume[i]);
+	}
+	vol_ramp_complete(cd);
 
 	dev->state = COMP_STATE_PREPARE;
 	return 0;
@@ -637,7 +1052,7 @@ static int volume_preload(struct comp_dev *dev)
 	/* make sure there is enough space in sink buffer */
 	sink = list_first_item(&dev->bsink_list, struct comp_buffer,
 		source_list);
-	if (sink->free < cd->sink_period_bytes)
+	if (comp_buffer_get_free(sink) < cd->sink_period_bytes)
 		return 0;
 
 	return volume_copy(dev);
@@ -653,6 +1068,7 @@ static int volume_reset(struct comp_dev *dev)
 
 struct comp_driver comp_volume = {
 	.type	= SOF_COMP_VOLUME,
+	.inplace = 1,
 	.ops	= {
 		.new		= volume_new,
 		.free		= volume_free,
@@ -56,6 +56,7 @@
 #include <reef/lock.h>
 #include <reef/trace.h>
 #include <reef/wait.h>
+#include <reef/schedule.h>
 #include <reef/audio/component.h>
 #include <platform/dma.h>
 #include <platform/platform.h>
@@ -163,6 +164,7 @@ struct dma_chan_data {
 	uint32_t direction;
 	struct dw_lli2 *lli;
 	struct dw_lli2 *lli_current;
+	struct dw_lli2 lli_single;	/* lli for single block transfers */
 	uint32_t desc_count;
 	uint32_t cfg_lo;
 	uint32_t cfg_hi;
@@ -249,10 +251,9 @@ static void dw_dma_channel_put_unlocked(struct dma *dma, int channel)
 	dw_write(dma, DW_MASK_ERR, INT_MASK(channel));
 
 	/* free the lli allocated by set_config*/
-	if (p->chan[channel].lli) {
+	if (p->chan[channel].lli != &p->chan[channel].lli_single)
 		rfree(p->chan[channel].lli);
-		p->chan[channel].lli = NULL;
-	}
+	p->chan[channel].lli = NULL;
 
 	/* set new state */
 	p->chan[channel].status = COMP_STATE_READY;
@@ -461,10 +462,16 @@ static int dw_dma_set_config(struct dma *dma, int channel,
 		p->chan[channel].desc_count = desc_count;
 
 		/* allocate descriptors for channel */
-		if (p->chan[channel].lli)
+		if (p->chan[channel].lli != &p->chan[channel].lli_single)
 			rfree(p->chan[channel].lli);
-		p->chan[channel].lli = rzalloc(RZONE_RUNTIME, RFLAGS_NONE,
-			sizeof(struct dw_lli2) * p->chan[channel].desc_count);
+
+		/* single blocks use the channel lli so nothing is allocated */
+		if (desc_count == 1)
+			p->chan[channel].lli = &p->chan[channel].lli_single;
+		else
+			p->chan[channel].lli = rzalloc(RZONE_RUNTIME,
+				RFLAGS_NONE, sizeof(struct dw_lli2) *
+				p->chan[channel].desc_count);
 		if (p->chan[channel].lli == NULL) {
 			trace_dma_error("eDm");
 			return -ENOMEM;
@@ -714,6 +721,9 @@ static void dw_dma_irq_handler(void *data)
 		trace_dma_error("eii");
 	}
 
+	/* channel callbacks can schedule pipelines, run scheduler once */
+	schedule_batch_begin();
+
 	for (i = 0; i < DW_MAX_CHAN; i++) {
 
 		/* skip if channel is not running */
@@ -759,6 +769,8 @@ static void dw_dma_irq_handler(void *data)
 		}
 #endif
 	}
+
+	schedule_batch_end();
 }
 
 static void dw_dma_setup(struct dma *dma)
@@ -64,10 +64,24 @@ struct reef;
 #define RFLAGS_ATOMIC	2   /* allocation with IRQs off */
 #define RFLAGS_DMA		4   /* DMA-able memory */
 #define RFLAGS_POWER	8   /* low power memory */
+#define RFLAGS_ARENA	16  /* block owned by a pipeline arena */
 
 struct mm_info {
 	uint32_t used;
 	uint32_t free;
+	uint32_t peak;		/* max bytes used */
+	uint32_t failures;	/* failed allocations */
+	uint32_t largest_free;	/* largest continuous free bytes */
+};
+
+/* heap block map statistics */
+struct mm_map_info {
+	uint32_t block_size;
+	uint32_t count;		/* blocks in map */
+	uint32_t used;		/* blocks used */
+	uint32_t peak;		/* max blocks used */
+	uint32_t failures;	/* failed allocations */
+	uint32_t largest_free;	/* largest continuous free run in blocks */
 };
 
 /* heap allocation and free */
@@ -75,10 +89,21 @@ void *rmalloc(int zone, int flags, size_t bytes);
 void *rzalloc(int zone, int flags, size_t bytes);
 void rfree(void *ptr);
 
-/* heap allocation and free for buffers on 1k boundary */
+/* heap allocation and free for cache line aligned buffers */
 void *rballoc(int zone, int flags, size_t bytes);
 void rbfree(void *ptr);
 
+/* pipeline arena - allocations made while an arena is selected come from
+ * the arena and are released together when its last reference is put */
+struct mm_arena;
+struct mm_arena *arena_get(uint32_t id);
+void arena_put(struct mm_arena *arena);
+struct mm_arena *arena_select(struct mm_arena *arena);
+
+/* heap statistics - returns number of block maps or negative error */
+int mm_heap_info(int zone, int bflags, struct mm_info *info,
+	struct mm_map_info *map, int maps);
+
 /* utility */
 void bzero(void *s, size_t n);
 void *memset(void *s, int c, size_t n);
@@ -33,6 +33,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <reef/reef.h>
 #include <reef/lock.h>
 #include <reef/list.h>
 #include <reef/stream.h>
@@ -41,23 +42,38 @@
 #include <reef/trace.h>
 #include <reef/schedule.h>
 #include <uapi/ipc.h>
+#include <arch/cache.h>
 
 /* pipeline tracing */
 #define trace_buffer(__e)	trace_event(TRACE_CLASS_BUFFER, __e)
 #define trace_buffer_error(__e)	trace_error(TRACE_CLASS_BUFFER, __e)
 #define tracev_buffer(__e)	tracev_event(TRACE_CLASS_BUFFER, __e)
 
-/* audio component buffer - connects 2 audio components together in pipeline */
+/* audio component buffer - connects 2 audio components together in pipeline
+ *
+ * The buffer is a single producer (source) single consumer (sink) ring.
+ * Each side only ever writes its own free running byte counter and pointer,
+ * so avail and free are calculated on demand from both counters and the
+ * source and sink can update the buffer from different IRQ contexts or cores
+ * without locking.
+ *
+ * Components that transform data 1:1 can be run in place by the pipeline.
+ * Their sink buffer then shares the memory of the source buffer, and space in
+ * that memory is only freed when it is consumed by the last buffer sharing it.
+ *
+ * The producer and consumer positions are in their own cache lines so a cross
+ * core write back or invalidate of one side never touches the other side.
+ * Buffers are allocated cache line aligned from the buffer heap for this.
+ */
 struct comp_buffer {
 
 	/* runtime data */
 	uint32_t connected;	/* connected in path */
+	uint32_t cross_core;	/* source and sink run on different cores */
+	struct comp_buffer *inplace;	/* buffer owning memory when in place */
+	struct comp_buffer *release;	/* last consumer of our memory */
 	uint32_t size;		/* runtime buffer size in bytes (period multiple) */
 	uint32_t alloc_size;	/* allocated size in bytes */
-	uint32_t avail;		/* available bytes for reading */
-	uint32_t free;		/* free bytes for writing */
-	void *w_ptr;		/* buffer write pointer */
-	void *r_ptr;		/* buffer read position */
 	void *addr;		/* buffer base address */
 	void *end_addr;		/* buffer end address */
 
@@ -71,43 +87,221 @@ struct comp_buffer {
 	/* lists */
 	struct list_item source_list;	/* list in comp buffers */
 	struct list_item sink_list;	/* list in comp buffers */
+
+	/* producer position - only written by source, own cache line */
+	struct {
+		uint32_t w_count;	/* total bytes produced */
+		void *w_ptr;		/* buffer write pointer */
+	} __attribute__((aligned(DCACHE_LINE_SIZE)));
+
+	/* consumer position - only written by sink, own cache line */
+	struct {
+		uint32_t r_count;	/* total bytes consumed */
+		uint32_t wb_count;	/* total bytes written back for DMA */
+		void *r_ptr;		/* buffer read position */
+	} __attribute__((aligned(DCACHE_LINE_SIZE)));
+};
+
+/*
+ * Linear view of buffer data as at most 2 contiguous segments, split where
+ * the data wraps at the end of the buffer. Used for cache maintenance,
+ * processing kernels walk frames with buffer_linear_frames().
+ */
+struct comp_buffer_span {
+	void *addr[2];		/* segment start address */
+	uint32_t bytes[2];	/* segment size in bytes, 0 if unused */
 };
 
 /* pipeline buffer creation and destruction */
 struct comp_buffer *buffer_new(struct sof_ipc_buffer *desc);
 void buffer_free(struct comp_buffer *buffer);
 
+/*
+ * Cross core buffers are not cache coherent between source and sink cores so
+ * the counter owned by the other core is invalidated before reading it and
+ * our own counter and any produced data are written back after updating.
+ */
+static inline uint32_t buffer_get_count(struct comp_buffer *buffer,
+	uint32_t *count)
+{
+	if (buffer->cross_core)
+		dcache_invalidate_region(count, sizeof(*count));
+
+	return READ_ONCE(*count);
+}
+
+static inline void buffer_set_count(struct comp_buffer *buffer,
+	uint32_t *count, uint32_t value)
+{
+	/* data and reads must complete before the new count is visible */
+	memory_barrier();
+	WRITE_ONCE(*count, value);
+
+	if (buffer->cross_core)
+		dcache_writeback_region(count, sizeof(*count));
+}
+
+/* get bytes available for reading */
+static inline uint32_t comp_buffer_get_avail(struct comp_buffer *buffer)
+{
+	return buffer_get_count(buffer, &buffer->w_count) -
+		buffer_get_count(buffer, &buffer->r_count);
+}
+
+/* get bytes free for writing, space is freed by the last in place consumer */
+static inline uint32_t comp_buffer_get_free(struct comp_buffer *buffer)
+{
+	struct comp_buffer *release = buffer->release;
+
+	return buffer->size - (buffer_get_count(buffer, &buffer->w_count) -
+		buffer_get_count(release, &release->r_count));
+}
+
+/* get span of bytes starting at ptr inside the buffer */
+static inline void buffer_get_span(struct comp_buffer *buffer, void *ptr,
+	uint32_t bytes, struct comp_buffer_span *span)
+{
+	uint32_t head = buffer->end_addr - ptr;
+
+	span->addr[0] = ptr;
+
+	if (bytes <= head) {
+		span->bytes[0] = bytes;
+		span->addr[1] = NULL;
+		span->bytes[1] = 0;
+	} else {
+		span->bytes[0] = head;
+		span->addr[1] = buffer->addr;
+		span->bytes[1] = bytes - head;
+	}
+}
+
+/*
+ * Get number of frames at ptr that can be accessed before buffer wraps. The
+ * buffer size must be a whole number of frames or this can return 0.
+ */
+static inline uint32_t buffer_linear_frames(struct comp_buffer *buffer,
+	void *ptr, uint32_t frame_bytes)
+{
+	return (buffer->end_addr - ptr) / frame_bytes;
+}
+
+/* can frames of frame_bytes be walked linearly without splitting at the wrap */
+static inline int buffer_frames_aligned(struct comp_buffer *buffer,
+	uint32_t frame_bytes)
+{
+	return frame_bytes != 0 && buffer->size % frame_bytes == 0;
+}
+
+/* wrap ptr that has been advanced up to or past the buffer end */
+static inline void *buffer_wrap_ptr(struct comp_buffer *buffer, void *ptr)
+{
+	if (ptr >= buffer->end_addr)
+		ptr = buffer->addr + (ptr - buffer->end_addr);
+
+	return ptr;
+}
+
+/*
+ * Invalidate bytes written by DMA at w_ptr before producing them, rounded out
+ * to whole cache lines. Buffers start and end on line boundaries and the CPU
+ * never writes a buffer filled by DMA (see inplace_valid()), so lines shared
+ * by two periods hold no dirty data and can be dropped without write back.
+ */
+static inline void comp_buffer_invalidate(struct comp_buffer *buffer,
+	uint32_t bytes)
+{
+	struct comp_buffer_span span;
+	uintptr_t start, end;
+	int i;
+
+	buffer_get_span(buffer, buffer->w_ptr, bytes, &span);
+
+	for (i = 0; i < 2 && span.bytes[i]; i++) {
+		start = ALIGN_DOWN((uintptr_t)span.addr[i], DCACHE_LINE_SIZE);
+		end = ALIGN_UP((uintptr_t)span.addr[i] + span.bytes[i],
+			DCACHE_LINE_SIZE);
+		dcache_invalidate_region((void *)start, end - start);
+	}
+}
+
+/*
+ * Write back all data produced since the last write back before DMA reads
+ * it. Called by the DMA consumer once per period so each produced region is
+ * written back once, rounded out to whole cache lines.
+ */
+static inline void comp_buffer_writeback(struct comp_buffer *buffer)
+{
+	struct comp_buffer_span span;
+	uint32_t w_count = buffer_get_count(buffer, &buffer->w_count);
+	uint32_t avail = w_count - buffer->r_count;
+	uint32_t done = buffer->wb_count - buffer->r_count;
+	uintptr_t start, end;
+	int i;
+
+	/* data consumed before it was written back ? */
+	if (done > avail)
+		done = 0;
+	if (done == avail)
+		return;
+
+	buffer_get_span(buffer, buffer_wrap_ptr(buffer, buffer->r_ptr + done),
+		avail - done, &span);
+
+	for (i = 0; i < 2 && span.bytes[i]; i++) {
+		start = ALIGN_DOWN((uintptr_t)span.addr[i], DCACHE_LINE_SIZE);
+		end = ALIGN_UP((uintptr_t)span.addr[i] + span.bytes[i],
+			DCACHE_LINE_SIZE);
+		dcache_writeback_region((void *)start, end - start);
+	}
+
+	buffer->wb_count = w_count;
+}
+
+/* write back bytes produced at w_ptr for the sink core */
+static inline void buffer_core_writeback(struct comp_buffer *buffer,
+	uint32_t bytes)
+{
+	struct comp_buffer_span span;
+
+	buffer_get_span(buffer, buffer->w_ptr, bytes, &span);
+
+	dcache_writeback_region(span.addr[0], span.bytes[0]);
+	if (span.bytes[1])
+		dcache_writeback_region(span.addr[1], span.bytes[1]);
+}
+
+/* sync data produced by the other core before copying */
+static inline void comp_buffer_core_sync(struct comp_buffer *buffer)
+{
+	if (buffer->cross_core)
+		dcache_invalidate_region(buffer->addr, buffer->size);
+}
+
 /* called by a component after pruducing data into this buffer */
 static inline void comp_update_buffer_produce(struct comp_buffer *buffer,
 	uint32_t bytes)
 {
+	uint32_t free = comp_buffer_get_free(buffer);
+
 	/* complain loudly if component tries to overrun buffer
 	 * components MUST check for free space first !! */
-	if (bytes > buffer->free) {
+	if (bytes > free) {
 		trace_buffer_error("Xxo");
 		trace_value(buffer->ipc_buffer.comp.id);
 		return;
 	}
 
-	buffer->w_ptr += bytes;
-
-	/* check for pointer wrap */
-	if (buffer->w_ptr >= buffer->end_addr)
-		buffer->w_ptr = buffer->addr + (buffer->w_ptr - buffer->end_addr);
+	if (buffer->cross_core)
+		buffer_core_writeback(buffer, bytes);
 
-	/* calculate available bytes */
-	if (buffer->r_ptr < buffer->w_ptr)
-		buffer->avail = buffer->w_ptr - buffer->r_ptr;
-	else if (buffer->r_ptr == buffer->w_ptr)
-		buffer->avail = buffer->size; /* full */
-	else
-		buffer->avail = buffer->size - (buffer->r_ptr - buffer->w_ptr);
+	buffer->w_ptr = buffer_wrap_ptr(buffer, buffer->w_ptr + bytes);
 
-	/* calculate free bytes */
-	buffer->free = buffer->size - buffer->avail;
+	/* publish the data to the sink */
+	buffer_set_count(buffer, &buffer->w_count, buffer->w_count + bytes);
 
 	tracev_buffer("pro");
-	tracev_value((buffer->avail << 16) | buffer->free);
+	tracev_value(((buffer->size - free + bytes) << 16) | (free - bytes));
 	tracev_value((buffer->ipc_buffer.comp.id << 16) | buffer->size);
 	tracev_value((buffer->r_ptr - buffer->addr) << 16 | (buffer->w_ptr - buffer->addr));
 }
@@ -116,33 +310,23 @@ static inline void comp_update_buffer_produce(struct comp_buffer *buffer,
 static inline void comp_update_buffer_consume(struct comp_buffer *buffer,
 	uint32_t bytes)
 {
+	uint32_t avail = comp_buffer_get_avail(buffer);
+
 	/* complain loudly if component tries to underrun buffer
 	 * components MUST check for avail space first !! */
-	if (buffer->avail < bytes) {
+	if (avail < bytes) {
 		trace_buffer_error("Xxu");
 		trace_value(buffer->ipc_buffer.comp.id);
 		return;
 	}
 
-	buffer->r_ptr += bytes;
-
-	/* check for pointer wrap */
-	if (buffer->r_ptr >= buffer->end_addr)
-		buffer->r_ptr = buffer->addr + (buffer->r_ptr - buffer->end_addr);
-
-	/* calculate available bytes */
-	if (buffer->r_ptr < buffer->w_ptr)
-		buffer->avail = buffer->w_ptr - buffer->r_ptr;
-	else if (buffer->r_ptr == buffer->w_ptr)
-		buffer->avail = 0; /* empty */
-	else
-		buffer->avail = buffer->size - (buffer->r_ptr - buffer->w_ptr);
+	buffer->r_ptr = buffer_wrap_ptr(buffer, buffer->r_ptr + bytes);
 
-	/* calculate free bytes */
-	buffer->free = buffer->size - buffer->avail;
+	/* release the space to the source */
+	buffer_set_count(buffer, &buffer->r_count, buffer->r_count + bytes);
 
 	tracev_buffer("con");
-	tracev_value((buffer->avail << 16) | buffer->free);
+	tracev_value(((avail - bytes) << 16) | (buffer->size - avail + bytes));
 	tracev_value((buffer->ipc_buffer.comp.id << 16) | buffer->size);
 	tracev_value((buffer->r_ptr - buffer->addr) << 16 | (buffer->w_ptr - buffer->addr));
 }
@@ -151,25 +335,29 @@ static inline void comp_update_buffer_consume(struct comp_buffer *buffer,
 static inline uint32_t comp_buffer_get_copy_bytes(struct comp_dev *dev,
 	struct comp_buffer *source, struct comp_buffer *sink)
 {
+	uint32_t avail = comp_buffer_get_avail(source);
+	uint32_t free = comp_buffer_get_free(sink);
 	uint32_t copy_bytes;
 
 	/* Check that source has enough frames available and sink enough
 	 * frames free.
 	 */
-	if (source->avail > sink->free)
-		copy_bytes = sink->free;
+	if (avail > free)
+		copy_bytes = free;
 	else
-		copy_bytes = source->avail;
+		copy_bytes = avail;
 
 	return copy_bytes;
 }
 
+/* must only be called when source and sink are not running */
 static inline void buffer_reset_pos(struct comp_buffer *buffer)
 {
 	buffer->r_ptr = buffer->addr;
 	buffer->w_ptr = buffer->addr;
-	buffer->free = buffer->size;
-	buffer->avail = 0;
+	buffer->r_count = 0;
+	buffer->w_count = 0;
+	buffer->wb_count = 0;
 }
 
 static inline void buffer_clear(struct comp_buffer *buffer)
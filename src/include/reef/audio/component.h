@@ -159,6 +159,7 @@ struct comp_ops {
 struct comp_driver {
 	uint32_t type;		/* SOF_COMP_ for driver */
 	uint32_t module_id;
+	uint32_t inplace;	/* 1:1 per sample transform, can run in place */
 
 	struct comp_ops ops;	/* component operations */
 
@@ -175,6 +176,7 @@ struct comp_dev {
 	uint64_t position;	/* component rendering position */
 	uint32_t frames;	/* number of frames we copy to sink */
 	uint32_t frame_bytes;	/* frames size copied to sink in bytes */
+	uint32_t cycles;	/* estimated DSP cycles per frame, set by params */
 	struct pipeline *pipeline;	/* pipeline we belong to */
 
 	/* common runtime configuration for downstream/upstream */
@@ -321,8 +323,7 @@ static inline int comp_buffer_reset(struct comp_dev *dev)
 		bzero(buffer->addr, buffer->ipc_buffer.size);
 		buffer->w_ptr = buffer->r_ptr = buffer->addr;
 		buffer->end_addr = buffer->addr + buffer->ipc_buffer.size;
-		buffer->free = buffer->ipc_buffer.size;
-		buffer->avail = 0;
+		buffer->w_count = buffer->r_count = buffer->wb_count = 0;
 	}
 
 	return 0;
@@ -361,21 +362,25 @@ static inline uint32_t comp_frame_bytes(struct comp_dev *dev)
 static inline void comp_underrun(struct comp_dev *dev, struct comp_buffer *source,
 	uint32_t copy_bytes, uint32_t min_bytes)
 {
+	uint32_t avail = comp_buffer_get_avail(source);
+
 	trace_comp("Xun");
-	trace_value((dev->comp.id << 16) | source->avail);
+	trace_value((dev->comp.id << 16) | avail);
 	trace_value((min_bytes << 16) | copy_bytes);
 
-	pipeline_xrun(dev->pipeline, dev, (int32_t)source->avail - copy_bytes);
+	pipeline_xrun(dev->pipeline, dev, (int32_t)avail - copy_bytes);
 }
 
 static inline void comp_overrun(struct comp_dev *dev, struct comp_buffer *sink,
 	uint32_t copy_bytes, uint32_t min_bytes)
 {
+	uint32_t free = comp_buffer_get_free(sink);
+
 	trace_comp("Xov");
-	trace_value((dev->comp.id << 16) | sink->free);
+	trace_value((dev->comp.id << 16) | free);
 	trace_value((min_bytes << 16) | copy_bytes);
 
-	pipeline_xrun(dev->pipeline, dev, (int32_t)copy_bytes - sink->free);
+	pipeline_xrun(dev->pipeline, dev, (int32_t)copy_bytes - free);
 }
 
 #endif
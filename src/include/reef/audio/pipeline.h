@@ -67,6 +67,16 @@ struct pipeline {
 	/* scheduling */
 	struct task pipe_task;		/* pipeline processing task */
 	struct comp_dev *sched_comp;
+	uint32_t kcps;			/* core load reserved in kcps */
+
+	/* flat copy schedule compiled from the component graph */
+	struct comp_dev **copy_list;	/* components in copy order */
+	uint32_t copy_count;		/* components in copy_list */
+	uint32_t copy_size;		/* capacity of copy_list */
+	uint32_t copy_dirty;		/* copy_list must be rebuilt */
+	uint32_t cross_core;		/* has buffers shared with other cores */
+
+	struct mm_arena *arena;		/* construction memory for pipeline */
 };
 
 /* static pipeline */
@@ -69,6 +69,17 @@ static inline void interrupt_clear(int irq)
 	arch_interrupt_clear(irq);
 }
 
+/* current interrupt level, 0 when not in IRQ context */
+static inline uint32_t interrupt_get_level(void)
+{
+	return arch_interrupt_get_level();
+}
+
+static inline uint32_t interrupt_get_irq_level(int irq)
+{
+	return arch_interrupt_get_irq_level(irq);
+}
+
 static inline uint32_t interrupt_global_disable(void)
 {
 	return arch_interrupt_global_disable();
@@ -67,6 +67,8 @@ struct ipc_comp_dev {
 		struct pipeline *pipeline;
 	};
 
+	struct mm_arena *arena;		/* pipeline arena holding this */
+
 	/* lists */
 	struct list_item list;		/* list in components */
 };
@@ -46,6 +46,15 @@ struct ipc;
 	({const typeof(((type *)0)->member) *__memberptr = (ptr); \
 	(type *)((char *)__memberptr - offsetof(type, member));})
 
+/* align value to power of 2 alignment */
+#define ALIGN_UP(val, align)	(((val) + (align) - 1) & ~((align) - 1))
+#define ALIGN_DOWN(val, align)	((val) & ~((align) - 1))
+
+/* access data shared with another IRQ context or core */
+#define READ_ONCE(x)		(*(volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, val)	(*(volatile typeof(x) *)&(x) = (val))
+#define memory_barrier()	arch_memory_barrier()
+
 /* C memcpy for arch that dont have arch_memcpy() */
 void cmemcpy(void *dest, void *src, size_t size);
 
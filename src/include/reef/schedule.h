@@ -55,6 +55,10 @@ struct reef;
 #define TASK_PRI_MED	0
 #define TASK_PRI_HIGH	-20
 
+/* periodic task policy for late periods */
+#define TASK_LATE_CATCHUP	0	/* run late periods back to back */
+#define TASK_LATE_SKIP		1	/* skip late periods */
+
 
 /* task descriptor */
 struct task {
@@ -63,6 +67,12 @@ struct task {
 	uint64_t start;			/* scheduling earliest start time */
 	uint64_t deadline;		/* scheduling deadline */
 	uint32_t state;			/* TASK_STATE_ */
+
+	/* periodic tasks in scheduling clock base */
+	uint64_t period;		/* period or 0 if not periodic */
+	uint64_t period_deadline;	/* deadline relative to period start */
+	uint32_t late;			/* TASK_LATE_ policy */
+	uint32_t skipped;		/* number of periods skipped */
 	struct list_item list;		/* list in scheduler */
 
 	/* task function and private data */
@@ -71,14 +81,40 @@ struct task {
 
 	/* runtime duration in scheduling clock base */
 	uint64_t max_rtime;		/* max time taken to run */
+	uint64_t peak_rtime;		/* decaying max used for EDF key */
+	uint64_t last_rtime;		/* time taken by last run */
+	uint64_t avg_rtime;		/* average time taken to run */
+	uint64_t run_start;		/* start time of current run */
+	uint64_t run_deadline;		/* deadline of current run */
+	uint32_t run_count;		/* number of completed runs */
+	uint32_t missed;		/* number of runs past deadline */
 };
 
 void schedule(void);
 
+void scheduler_run(void *unused);
+
 void schedule_task(struct task *task, uint64_t start, uint64_t deadline);
 
+void schedule_batch_begin(void);
+
+void schedule_batch_end(void);
+
+int schedule_batch_stats(int core, uint32_t *batches, uint32_t *coalesced);
+
+void schedule_task_periodic(struct task *task, uint64_t period,
+	uint64_t deadline, uint32_t late);
+
+void schedule_task_running(struct task *task);
+
 void schedule_task_complete(struct task *task);
 
+int schedule_task_del(struct task *task);
+
+int schedule_load_update(int core, uint32_t old_kcps, uint32_t new_kcps);
+
+uint32_t schedule_load_free(int core);
+
 static inline void schedule_task_init(struct task *task, void (*func)(void *),
 	void *data)
 {
@@ -86,6 +122,14 @@ static inline void schedule_task_init(struct task *task, void (*func)(void *),
 	task->state = TASK_STATE_INIT;
 	task->func = func;
 	task->data = data;
+	task->max_rtime = 0;
+	task->peak_rtime = 0;
+	task->last_rtime = 0;
+	task->avg_rtime = 0;
+	task->run_count = 0;
+	task->missed = 0;
+	task->period = 0;
+	task->skipped = 0;
 }
 
 static inline void schedule_task_free(struct task *task)
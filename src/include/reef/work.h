@@ -47,9 +47,9 @@ struct work_queue;
 struct work {
 	uint32_t (*cb)(void*, uint32_t udelay);	/* returns reschedule timeout in msecs */
 	void *cb_data;
-	struct list_item list;
-	uint32_t timeout;
-	uint32_t pending;
+	uint64_t timeout;	/* timesource ticks */
+	uint32_t queued;	/* work is in a work queue */
+	uint32_t index;		/* position in work queue */
 	uint32_t flags;
 };
 
@@ -66,6 +66,7 @@ struct work_queue_timesource {
 #define work_init(w, x, xd, xflags) \
 	(w)->cb = x; \
 	(w)->cb_data = xd; \
+	(w)->queued = 0; \
 	(w)->flags = xflags;
 
 /* schedule/cancel work on work queue */
@@ -73,7 +74,8 @@ void work_schedule(struct work_queue *queue, struct work *w, uint64_t timeout);
 void work_reschedule(struct work_queue *queue, struct work *w, uint64_t timeout);
 void work_cancel(struct work_queue *queue, struct work *work);
 
-/* schedule/cancel work on default system work queue */
+/* schedule/cancel work on default system work queue, the _at variant takes
+ * an absolute time in ticks of the 64 bit system work queue timesource */
 void work_schedule_default(struct work *work, uint64_t timeout);
 void work_reschedule_default(struct work *work, uint64_t timeout);
 void work_reschedule_default_at(struct work *w, uint64_t time);
@@ -117,6 +117,8 @@
 /* trace and debug */
 #define SOF_IPC_TRACE_DMA_INIT			SOF_CMD_TYPE(0x001)
 #define SOF_IPC_TRACE_DMA_PARAMS		SOF_CMD_TYPE(0x002)
+#define SOF_IPC_TRACE_PIPE_LOAD			SOF_CMD_TYPE(0x003)
+#define SOF_IPC_TRACE_HEAP_STATS		SOF_CMD_TYPE(0x004)
 
 /* Get message component id */
 #define SOF_IPC_MESSAGE_ID(x)			(x & 0xffff)
@@ -681,6 +683,63 @@ struct sof_ipc_pipe_new {
 	uint32_t timer;		/* non zero if timer scheduled otherwise DAI scheduled */
 }  __attribute__((packed));
 
+/* pipeline load query - SOF_IPC_TRACE_PIPE_LOAD */
+struct sof_ipc_pipe_load {
+	struct sof_ipc_hdr hdr;
+	uint32_t comp_id;	/* component id for pipeline */
+}  __attribute__((packed));
+
+/* pipeline load reply - all times in us */
+struct sof_ipc_pipe_load_reply {
+	struct sof_ipc_reply rhdr;
+	uint32_t comp_id;	/* component id for pipeline */
+	uint32_t deadline;	/* execution completion deadline */
+	uint32_t run_count;	/* number of completed pipeline runs */
+	uint32_t missed;	/* number of runs completed after deadline */
+	uint32_t last_rtime;	/* last run time */
+	uint32_t avg_rtime;	/* average run time */
+	uint32_t max_rtime;	/* max run time */
+	uint32_t sched_batches;	/* scheduler runs batched on pipeline core */
+	uint32_t sched_coalesced; /* schedule requests saved by batching */
+}  __attribute__((packed));
+
+/* heaps for SOF_IPC_TRACE_HEAP_STATS */
+#define SOF_IPC_HEAP_SYSTEM	0
+#define SOF_IPC_HEAP_RUNTIME	1
+#define SOF_IPC_HEAP_BUFFER	2
+#define SOF_IPC_HEAP_DMA	3
+
+#define SOF_IPC_MAX_HEAP_MAPS	8
+
+/* heap statistics query - SOF_IPC_TRACE_HEAP_STATS */
+struct sof_ipc_heap_stats {
+	struct sof_ipc_hdr hdr;
+	uint32_t heap;		/* SOF_IPC_HEAP_ */
+}  __attribute__((packed));
+
+/* heap block map statistics - counts in blocks */
+struct sof_ipc_heap_map_stats {
+	uint32_t block_size;	/* block size in bytes */
+	uint32_t count;		/* blocks in map */
+	uint32_t used;		/* blocks in use */
+	uint32_t peak;		/* max blocks in use */
+	uint32_t failures;	/* failed allocations */
+	uint32_t largest_free;	/* largest continuous free run */
+}  __attribute__((packed));
+
+/* heap statistics reply - sizes in bytes */
+struct sof_ipc_heap_stats_reply {
+	struct sof_ipc_reply rhdr;
+	uint32_t heap;		/* SOF_IPC_HEAP_ */
+	uint32_t used;		/* bytes in use */
+	uint32_t free;		/* bytes free */
+	uint32_t peak;		/* max bytes in use */
+	uint32_t failures;	/* failed allocations */
+	uint32_t largest_free;	/* largest continuous free space */
+	uint32_t num_maps;	/* valid entries in map */
+	struct sof_ipc_heap_map_stats map[SOF_IPC_MAX_HEAP_MAPS];
+}  __attribute__((packed));
+
 /* pipeline construction complete - SOF_IPC_TPLG_PIPE_COMPLETE */
 struct sof_ipc_pipe_ready {
 	struct sof_ipc_hdr hdr;
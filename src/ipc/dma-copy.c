@@ -37,6 +37,7 @@
 #include <reef/dma.h>
 #include <reef/wait.h>
 #include <platform/dma.h>
+#include <arch/cache.h>
 
 static struct dma_sg_elem *sg_get_elem_at(struct dma_sg_config *host_sg,
 	int32_t *offset)
@@ -80,6 +81,10 @@ int dma_copy_to_host(struct dma_sg_config *host_sg, int32_t host_offset,
 	struct dma *dma = dma_get(DMA_ID_DMAC0);
 	completion_t complete;
 	int32_t err, offset = host_offset, chan;
+	uint32_t local = (uint32_t)local_ptr;
+
+	if (size == 0)
+		return host_offset;
 
 	if (dma == NULL)
 		return -ENODEV;
@@ -106,10 +111,15 @@ int dma_copy_to_host(struct dma_sg_config *host_sg, int32_t host_offset,
 
 	/* configure local DMA elem */
 	local_sg_elem.dest = host_sg_elem->dest + offset;
-	local_sg_elem.src = (uint32_t)local_ptr;
-	local_sg_elem.size = HOST_PAGE_SIZE - offset;
+	local_sg_elem.src = local;
+	local_sg_elem.size = host_sg_elem->size - offset;
+	if (local_sg_elem.size > size)
+		local_sg_elem.size = size;
 	list_item_prepend(&local_sg_elem.list, &config.elem_list);
 
+	/* make sure host sees our data */
+	dcache_writeback_region(local_ptr, size);
+
 	dma_set_cb(dma, chan, DMA_IRQ_TYPE_LLIST, dma_complete, &complete);
 
 	/* transfer max PAGE size at a time to SG buffer */
@@ -131,17 +141,20 @@ int dma_copy_to_host(struct dma_sg_config *host_sg, int32_t host_offset,
 		/* update offset and bytes remaining */
 		size -= local_sg_elem.size;
 		host_offset += local_sg_elem.size;
+		local += local_sg_elem.size;
+		if (size <= 0)
+			break;
 
 		/* next dest host address is in next host elem */
 		host_sg_elem = list_next_item(host_sg_elem, list);
 		local_sg_elem.dest = host_sg_elem->dest;
 
 		/* local address is continuous */
-		local_sg_elem.src = (uint32_t)local_ptr + local_sg_elem.size;
+		local_sg_elem.src = local;
 
-		/* do we have less than 1 PAGE to copy ? */
-		if (size >= HOST_PAGE_SIZE)
-			local_sg_elem.size = HOST_PAGE_SIZE;
+		/* do we have less than 1 host elem to copy ? */
+		if (size >= host_sg_elem->size)
+			local_sg_elem.size = host_sg_elem->size;
 		else
 			local_sg_elem.size = size;
 	}
@@ -159,6 +172,10 @@ int dma_copy_from_host(struct dma_sg_config *host_sg, int32_t host_offset,
 	struct dma *dma = dma_get(DMA_ID_DMAC0);
 	completion_t complete;
 	int32_t err, offset = host_offset, chan;
+	uint32_t local = (uint32_t)local_ptr;
+
+	if (size == 0)
+		return host_offset;
 
 	if (dma == NULL)
 		return -ENODEV;
@@ -184,9 +201,11 @@ int dma_copy_from_host(struct dma_sg_config *host_sg, int32_t host_offset,
 	list_init(&config.elem_list);
 
 	/* configure local DMA elem */
-	local_sg_elem.dest = (uint32_t)local_ptr;
+	local_sg_elem.dest = local;
 	local_sg_elem.src = host_sg_elem->src + offset;
-	local_sg_elem.size = HOST_PAGE_SIZE - offset;
+	local_sg_elem.size = host_sg_elem->size - offset;
+	if (local_sg_elem.size > size)
+		local_sg_elem.size = size;
 	list_item_prepend(&local_sg_elem.list, &config.elem_list);
 
 	dma_set_cb(dma, chan, DMA_IRQ_TYPE_LLIST, dma_complete, &complete);
@@ -210,21 +229,27 @@ int dma_copy_from_host(struct dma_sg_config *host_sg, int32_t host_offset,
 		/* update offset and bytes remaining */
 		size -= local_sg_elem.size;
 		host_offset += local_sg_elem.size;
+		local += local_sg_elem.size;
+		if (size <= 0)
+			break;
 
 		/* next dest host address is in next host elem */
 		host_sg_elem = list_next_item(host_sg_elem, list);
 		local_sg_elem.src = host_sg_elem->src;
 
 		/* local address is continuous */
-		local_sg_elem.dest = (uint32_t)local_ptr + local_sg_elem.size;
+		local_sg_elem.dest = local;
 
-		/* do we have less than 1 PAGE to copy ? */
-		if (size >= HOST_PAGE_SIZE)
-			local_sg_elem.size = HOST_PAGE_SIZE;
+		/* do we have less than 1 host elem to copy ? */
+		if (size >= host_sg_elem->size)
+			local_sg_elem.size = host_sg_elem->size;
 		else
 			local_sg_elem.size = size;
 	}
 
+	/* drop any stale lines for the data we received */
+	dcache_invalidate_region(local_ptr, local - (uint32_t)local_ptr);
+
 	/* new host offset in SG buffer */
 	dma_channel_put(dma, chan);
 	return host_offset;
@@ -47,11 +47,14 @@
 #include <reef/wait.h>
 #include <reef/trace.h>
 #include <reef/ssp.h>
+#include <reef/clock.h>
 #include <platform/interrupt.h>
 #include <platform/mailbox.h>
 #include <platform/shim.h>
 #include <platform/dma.h>
 #include <platform/timer.h>
+#include <platform/platform.h>
+#include <platform/clk.h>
 #include <reef/audio/component.h>
 #include <reef/audio/pipeline.h>
 #include <uapi/ipc.h>
@@ -149,6 +152,23 @@ out:
 	return ret;
 }
 
+/* physical address of page i in the compressed 20 bit page table */
+static uint32_t page_descriptor_addr(struct intel_ipc_data *iipc, int i)
+{
+	uint32_t idx, phy_addr;
+
+	idx = (((i << 2) + i)) >> 1;
+	phy_addr = iipc->page_table[idx] | (iipc->page_table[idx + 1] << 8)
+			| (iipc->page_table[idx + 2] << 16);
+
+	if (i & 0x1)
+		phy_addr <<= 8;
+	else
+		phy_addr <<= 12;
+
+	return phy_addr & 0xfffff000;
+}
+
 /*
  * Parse the host page tables and create the audio DMA SG configuration
  * for host audio DMA buffer. This involves creating a dma_sg_elem for each
@@ -162,7 +182,7 @@ static int parse_page_descriptors(struct intel_ipc_data *iipc,
 	struct dma_trace_data *d = NULL;
 	struct dma_sg_elem elem;
 	int i, err;
-	uint32_t idx, phy_addr;
+	uint32_t phy_addr;
 
 	elem.size = HOST_PAGE_SIZE;
 	if (is_trace)
@@ -174,15 +194,7 @@ static int parse_page_descriptors(struct intel_ipc_data *iipc,
 
 	for (i = 0; i < ring->pages; i++) {
 
-		idx = (((i << 2) + i)) >> 1;
-		phy_addr = iipc->page_table[idx] | (iipc->page_table[idx + 1] << 8)
-				| (iipc->page_table[idx + 2] << 16);
-
-		if (i & 0x1)
-			phy_addr <<= 8;
-		else
-			phy_addr <<= 12;
-		phy_addr &= 0xfffff000;
+		phy_addr = page_descriptor_addr(iipc, i);
 
 		if (!is_trace && host->direction == SOF_IPC_STREAM_PLAYBACK)
 			elem.src = phy_addr;
@@ -493,16 +505,65 @@ static int ipc_pm_context_size(uint32_t header)
 
 	bzero(&pm_ctx, sizeof(pm_ctx));
 
-	/* TODO: calculate the context and size of host buffers required */
+	/* size of host buffer required for heap context */
+	pm_ctx.size = mm_pm_context_size();
 
 	/* write the context to the host driver */
 	mailbox_hostbox_write(0, &pm_ctx, sizeof(pm_ctx));
 	return 1;
 }
 
+/* max pages described by the page table, 20 bits each */
+#define PM_CTX_MAX_PAGES	(PLATFORM_PAGE_TABLE_SIZE * 8 / 20)
+
+/* host SG elems for the context, kept out of the heaps that are copied */
+static struct dma_sg_elem pm_ctx_elem[PM_CTX_MAX_PAGES];
+
+/*
+ * Create the host SG buffer config for the PM context from the host page
+ * table. Both src and dest are set as the buffer is written on save and read
+ * on restore.
+ */
+static int ipc_pm_context_sg(struct intel_ipc_data *iipc,
+	struct sof_ipc_host_buffer *ring, struct dma_sg_config *sg)
+{
+	uint32_t size = ring->size;
+	int i, err;
+
+	if (ring->pages == 0 || ring->pages > PM_CTX_MAX_PAGES) {
+		trace_ipc_error("ePg");
+		trace_value(ring->pages);
+		return -EINVAL;
+	}
+
+	/* use DMA to read in compressed page table from host */
+	err = get_page_descriptors(iipc, ring);
+	if (err < 0) {
+		trace_ipc_error("ePd");
+		return err;
+	}
+
+	bzero(sg, sizeof(*sg));
+	list_init(&sg->elem_list);
+
+	for (i = 0; i < ring->pages && size > 0; i++) {
+		pm_ctx_elem[i].src = page_descriptor_addr(iipc, i);
+		pm_ctx_elem[i].dest = pm_ctx_elem[i].src;
+		pm_ctx_elem[i].size = size < HOST_PAGE_SIZE ?
+			size : HOST_PAGE_SIZE;
+		size -= pm_ctx_elem[i].size;
+		list_item_append(&pm_ctx_elem[i].list, &sg->elem_list);
+	}
+
+	return 0;
+}
+
 static int ipc_pm_context_save(uint32_t header)
 {
+	struct intel_ipc_data *iipc = ipc_get_drvdata(_ipc);
 	struct sof_ipc_pm_ctx *pm_ctx = _ipc->comp_data;
+	struct dma_sg_config sg;
+	int ret;
 
 	trace_ipc("PMs");
 
@@ -510,8 +571,17 @@ static int ipc_pm_context_save(uint32_t header)
 
 	/* TODO: mask ALL platform interrupts except DMA */
 
-	/* TODO now save the context - create SG buffer config using */
-	//mm_pm_context_save(struct dma_sg_config *sg);
+	/* create SG buffer config for the host context buffer */
+	ret = ipc_pm_context_sg(iipc, &pm_ctx->buffer, &sg);
+	if (ret < 0)
+		return ret;
+
+	/* now save the context */
+	ret = mm_pm_context_save(&sg);
+	if (ret < 0) {
+		trace_ipc_error("ePS");
+		return ret;
+	}
 
 	/* mask all DSP interrupts */
 	arch_interrupt_disable_mask(0xffff);
@@ -525,10 +595,8 @@ static int ipc_pm_context_save(uint32_t header)
 
 	/* TODO: disable SSP and DMA HW */
 
-	/* TODO: save the context */
-	//reply.entries_no = 0;
-
-	/* write the context to the host driver */
+	/* write the saved context size to the host driver */
+	pm_ctx->size = ret;
 	mailbox_hostbox_write(0, pm_ctx, sizeof(*pm_ctx));
 
 	//iipc->pm_prepare_D3 = 1;
@@ -538,11 +606,24 @@ static int ipc_pm_context_save(uint32_t header)
 
 static int ipc_pm_context_restore(uint32_t header)
 {
-//	struct sof_ipc_pm_ctx pm_ctx = _ipc->comp_data;
+	struct intel_ipc_data *iipc = ipc_get_drvdata(_ipc);
+	struct sof_ipc_pm_ctx *pm_ctx = _ipc->comp_data;
+	struct dma_sg_config sg;
+	int ret;
 
 	trace_ipc("PMr");
 
-	/* now restore the context */
+	/* create SG buffer config for the host context buffer */
+	ret = ipc_pm_context_sg(iipc, &pm_ctx->buffer, &sg);
+	if (ret < 0)
+		return ret;
+
+	/* now restore the context, pm_ctx is overwritten */
+	ret = mm_pm_context_restore(&sg);
+	if (ret < 0) {
+		trace_ipc_error("ePR");
+		return ret;
+	}
 
 	return 0;
 }
@@ -640,6 +721,112 @@ error:
 	return -EINVAL;
 }
 
+/* get pipeline task runtime statistics */
+static int ipc_pipe_load(uint32_t header)
+{
+	struct sof_ipc_pipe_load *load = _ipc->comp_data;
+	struct sof_ipc_pipe_load_reply reply;
+	struct ipc_comp_dev *ipc_pipe;
+	struct task *task;
+	uint32_t batches, coalesced;
+
+	trace_ipc("Dpl");
+
+	/* get the pipeline */
+	ipc_pipe = ipc_get_comp(_ipc, load->comp_id);
+	if (ipc_pipe == NULL || ipc_pipe->type != COMP_TYPE_PIPELINE) {
+		trace_ipc_error("eDl");
+		trace_value(load->comp_id);
+		return -ENODEV;
+	}
+
+	task = &ipc_pipe->pipeline->pipe_task;
+
+	/* write pipeline load to the outbox */
+	reply.rhdr.hdr.size = sizeof(reply);
+	reply.rhdr.hdr.cmd = header;
+	reply.rhdr.error = 0;
+	reply.comp_id = load->comp_id;
+	reply.deadline = ipc_pipe->pipeline->ipc_pipe.deadline;
+	reply.run_count = task->run_count;
+	reply.missed = task->missed;
+	reply.last_rtime = clock_ticks_to_us(PLATFORM_SCHED_CLOCK,
+		task->last_rtime);
+	reply.avg_rtime = clock_ticks_to_us(PLATFORM_SCHED_CLOCK,
+		task->avg_rtime);
+	reply.max_rtime = clock_ticks_to_us(PLATFORM_SCHED_CLOCK,
+		task->max_rtime);
+	if (schedule_batch_stats(task->core, &batches, &coalesced) < 0) {
+		batches = 0;
+		coalesced = 0;
+	}
+	reply.sched_batches = batches;
+	reply.sched_coalesced = coalesced;
+	mailbox_hostbox_write(0, &reply, sizeof(reply));
+	return 1;
+}
+
+/* get heap usage statistics */
+static int ipc_heap_stats(uint32_t header)
+{
+	struct sof_ipc_heap_stats *stats = _ipc->comp_data;
+	struct sof_ipc_heap_stats_reply reply;
+	struct mm_map_info map[SOF_IPC_MAX_HEAP_MAPS];
+	struct mm_info info;
+	int zone, bflags = RFLAGS_NONE;
+	int i, maps;
+
+	trace_ipc("Dhs");
+
+	switch (stats->heap) {
+	case SOF_IPC_HEAP_SYSTEM:
+		zone = RZONE_SYS;
+		break;
+	case SOF_IPC_HEAP_RUNTIME:
+		zone = RZONE_RUNTIME;
+		break;
+	case SOF_IPC_HEAP_DMA:
+		bflags = RFLAGS_DMA;
+		/* fall through */
+	case SOF_IPC_HEAP_BUFFER:
+		zone = RZONE_BUFFER;
+		break;
+	default:
+		trace_ipc_error("eDh");
+		trace_value(stats->heap);
+		return -EINVAL;
+	}
+
+	maps = mm_heap_info(zone, bflags, &info, map, SOF_IPC_MAX_HEAP_MAPS);
+	if (maps < 0)
+		return maps;
+
+	/* write heap statistics to the outbox */
+	bzero(&reply, sizeof(reply));
+	reply.rhdr.hdr.size = sizeof(reply);
+	reply.rhdr.hdr.cmd = header;
+	reply.rhdr.error = 0;
+	reply.heap = stats->heap;
+	reply.used = info.used;
+	reply.free = info.free;
+	reply.peak = info.peak;
+	reply.failures = info.failures;
+	reply.largest_free = info.largest_free;
+	reply.num_maps = maps;
+
+	for (i = 0; i < maps; i++) {
+		reply.map[i].block_size = map[i].block_size;
+		reply.map[i].count = map[i].count;
+		reply.map[i].used = map[i].used;
+		reply.map[i].peak = map[i].peak;
+		reply.map[i].failures = map[i].failures;
+		reply.map[i].largest_free = map[i].largest_free;
+	}
+
+	mailbox_hostbox_write(0, &reply, sizeof(reply));
+	return 1;
+}
+
 static int ipc_glb_debug_message(uint32_t header)
 {
 	uint32_t cmd = (header & SOF_CMD_TYPE_MASK) >> SOF_CMD_TYPE_SHIFT;
@@ -651,6 +838,10 @@ static int ipc_glb_debug_message(uint32_t header)
 		return ipc_dma_trace_init(header);
 	case iCS(SOF_IPC_TRACE_DMA_PARAMS):
 		return ipc_dma_trace_config(header);
+	case iCS(SOF_IPC_TRACE_PIPE_LOAD):
+		return ipc_pipe_load(header);
+	case iCS(SOF_IPC_TRACE_HEAP_STATS):
+		return ipc_heap_stats(header);
 	default:
 		trace_ipc_error("eDc");
 		trace_value(header);
@@ -39,6 +39,7 @@
 #include <reef/alloc.h>
 #include <reef/ipc.h>
 #include <reef/debug.h>
+#include <platform/platform.h>
 #include <reef/audio/component.h>
 #include <reef/audio/pipeline.h>
 #include <reef/audio/buffer.h>
@@ -81,6 +82,7 @@ int ipc_comp_new(struct ipc *ipc, struct sof_ipc_comp *comp)
 {
 	struct comp_dev *cd;
 	struct ipc_comp_dev *icd;
+	struct mm_arena *arena, *prev;
 	int ret = 0;
 
 	/* check whether component already exists */
@@ -91,11 +93,16 @@ int ipc_comp_new(struct ipc *ipc, struct sof_ipc_comp *comp)
 		return -EINVAL;
 	}
 
+	/* component memory comes from its pipeline arena */
+	arena = arena_get(comp->pipeline_id);
+	prev = arena_select(arena);
+
 	/* create component */
 	cd = comp_new(comp);
 	if (cd == NULL) {
 		trace_ipc_error("eCn");
-		return -EINVAL;
+		ret = -EINVAL;
+		goto err;
 	}
 
 	/* allocate the IPC component container */
@@ -103,19 +110,29 @@ int ipc_comp_new(struct ipc *ipc, struct sof_ipc_comp *comp)
 	if (icd == NULL) {
 		trace_ipc_error("eCm");
 		rfree(cd);
-		return -ENOMEM;
+		ret = -ENOMEM;
+		goto err;
 	}
+	arena_select(prev);
+
 	icd->cd = cd;
 	icd->type = COMP_TYPE_COMPONENT;
+	icd->arena = arena;
 
 	/* add new component to the list */
 	list_item_append(&icd->list, &ipc->comp_list);
 	return ret;
+
+err:
+	arena_select(prev);
+	arena_put(arena);
+	return ret;
 }
 
 int ipc_comp_free(struct ipc *ipc, uint32_t comp_id)
 {
 	struct ipc_comp_dev *icd;
+	struct mm_arena *arena;
 
 	/* check whether component exists */
 	icd = ipc_get_comp(ipc, comp_id);
@@ -123,9 +140,11 @@ int ipc_comp_free(struct ipc *ipc, uint32_t comp_id)
 		return -ENODEV;
 
 	/* free component and remove from list */
+	arena = icd->arena;
 	comp_free(icd->cd);
 	list_item_del(&icd->list);
 	rfree(icd);
+	arena_put(arena);
 
 	return 0;
 }
@@ -134,6 +153,7 @@ int ipc_buffer_new(struct ipc *ipc, struct sof_ipc_buffer *desc)
 {
 	struct ipc_comp_dev *ibd;
 	struct comp_buffer *buffer;
+	struct mm_arena *arena, *prev;
 	int ret = 0;
 
 	/* check whether buffer already exists */
@@ -144,30 +164,44 @@ int ipc_buffer_new(struct ipc *ipc, struct sof_ipc_buffer *desc)
 		return -EINVAL;
 	}
 
+	/* buffer memory comes from its pipeline arena */
+	arena = arena_get(desc->comp.pipeline_id);
+	prev = arena_select(arena);
+
 	/* register buffer with pipeline */
 	buffer = buffer_new(desc);
 	if (buffer == NULL) {
 		trace_ipc_error("eBn");
-		rfree(ibd);
-		return -ENOMEM;
+		ret = -ENOMEM;
+		goto err;
 	}
 
 	ibd = rzalloc(RZONE_RUNTIME, RFLAGS_NONE, sizeof(struct ipc_comp_dev));
 	if (ibd == NULL) {
-		rfree(buffer);
-		return -ENOMEM;
+		buffer_free(buffer);
+		ret = -ENOMEM;
+		goto err;
 	}
+	arena_select(prev);
+
 	ibd->cb = buffer;
 	ibd->type = COMP_TYPE_BUFFER;
+	ibd->arena = arena;
 
 	/* add new buffer to the list */
 	list_item_append(&ibd->list, &ipc->comp_list);
 	return ret;
+
+err:
+	arena_select(prev);
+	arena_put(arena);
+	return ret;
 }
 
 int ipc_buffer_free(struct ipc *ipc, uint32_t buffer_id)
 {
 	struct ipc_comp_dev *ibd;
+	struct mm_arena *arena;
 
 	/* check whether buffer exists */
 	ibd = ipc_get_comp(ipc, buffer_id);
@@ -175,9 +209,11 @@ int ipc_buffer_free(struct ipc *ipc, uint32_t buffer_id)
 		return -ENODEV;
 
 	/* free buffer and remove from list */
+	arena = ibd->arena;
 	buffer_free(ibd->cb);
 	list_item_del(&ibd->list);
 	rfree(ibd);
+	arena_put(arena);
 
 	return 0;
 }
@@ -247,6 +283,13 @@ int ipc_pipeline_new(struct ipc *ipc,
 		return -EINVAL;
 	}
 
+	/* pipeline must run on a core we have */
+	if (pipe_desc->core >= PLATFORM_CORE_COUNT) {
+		trace_ipc_error("ePC");
+		trace_value(pipe_desc->core);
+		return -EINVAL;
+	}
+
 	/* create the pipeline */
 	pipe = pipeline_new(pipe_desc, icd->cd);
 	if (pipe == NULL) {
@@ -34,8 +34,30 @@
 #include <reef/debug.h>
 #include <reef/trace.h>
 #include <reef/lock.h>
+#include <reef/interrupt.h>
 #include <platform/memory.h>
+#include <arch/cache.h>
 #include <stdint.h>
+#include <errno.h>
+
+/* buffers are cache line aligned so DMA and CPU data never share a line */
+#if (HEAP_BUFFER_BASE % DCACHE_LINE_SIZE) || \
+	(HEAP_BUF_BLOCK_SIZE0 % DCACHE_LINE_SIZE) || \
+	(HEAP_BUF_BLOCK_SIZE1 % DCACHE_LINE_SIZE) || \
+	(HEAP_BUF_BLOCK_SIZE2 % DCACHE_LINE_SIZE)
+#error "buffer heap is not cache line aligned"
+#endif
+
+#if (HEAP_BUFFER_BASE + HEAP_BUFFER_SIZE > REEF_STACK_END)
+#error "buffer heap overlaps stack"
+#endif
+
+#if (HEAP_DMA_BUFFER_SIZE > 0)
+#if (HEAP_DMA_BUFFER_BASE % DCACHE_LINE_SIZE) || \
+	(HEAP_DMA_BUFFER_BLOCK_SIZE % DCACHE_LINE_SIZE)
+#error "DMA buffer heap is not cache line aligned"
+#endif
+#endif
 
 /* debug to set memory value on every allocation */
 #define DEBUG_BLOCK_ALLOC		0
@@ -76,12 +98,19 @@ struct block_map {
 	uint16_t count;		/* number of blocks in map */
 	uint16_t free_count;	/* number of free blocks */
 	uint16_t first_free;	/* index of first free block */
+	uint16_t peak;		/* max used blocks */
+	uint16_t failures;	/* failed allocations, saturating */
 	struct block_hdr *block;	/* base block header */
+	uint32_t *bitmap;	/* used block bitmap, bit set if block used */
 	uint32_t base;		/* base address of space */
 } __attribute__ ((packed));
 
-#define BLOCK_DEF(sz, cnt, hdr) \
-	{.block_size = sz, .count = cnt, .free_count = cnt, .block = hdr}
+#define BLOCK_DEF(sz, cnt, hdr, bmap) \
+	{.block_size = sz, .count = cnt, .free_count = cnt, .block = hdr, \
+	.bitmap = bmap}
+
+/* number of 32 bit bitmap words for count blocks */
+#define BITMAP_WORDS(count)	(((count) + 31) >> 5)
 
 /* Heap blocks for modules */
 //static struct block_hdr mod_block8[HEAP_RT_COUNT8];
@@ -93,33 +122,81 @@ static struct block_hdr mod_block256[HEAP_RT_COUNT256];
 static struct block_hdr mod_block512[HEAP_RT_COUNT512];
 static struct block_hdr mod_block1024[HEAP_RT_COUNT1024];
 
+/* Heap block bitmaps for modules */
+//static uint32_t mod_bitmap8[BITMAP_WORDS(HEAP_RT_COUNT8)];
+static uint32_t mod_bitmap16[BITMAP_WORDS(HEAP_RT_COUNT16)];
+static uint32_t mod_bitmap32[BITMAP_WORDS(HEAP_RT_COUNT32)];
+static uint32_t mod_bitmap64[BITMAP_WORDS(HEAP_RT_COUNT64)];
+static uint32_t mod_bitmap128[BITMAP_WORDS(HEAP_RT_COUNT128)];
+static uint32_t mod_bitmap256[BITMAP_WORDS(HEAP_RT_COUNT256)];
+static uint32_t mod_bitmap512[BITMAP_WORDS(HEAP_RT_COUNT512)];
+static uint32_t mod_bitmap1024[BITMAP_WORDS(HEAP_RT_COUNT1024)];
+
 /* Heap memory map for modules */
 static struct block_map rt_heap_map[] = {
-/*	BLOCK_DEF(8, HEAP_RT_COUNT8, mod_block8), */
-	BLOCK_DEF(16, HEAP_RT_COUNT16, mod_block16),
-	BLOCK_DEF(32, HEAP_RT_COUNT32, mod_block32),
-	BLOCK_DEF(64, HEAP_RT_COUNT64, mod_block64),
-	BLOCK_DEF(128, HEAP_RT_COUNT128, mod_block128),
-	BLOCK_DEF(256, HEAP_RT_COUNT256, mod_block256),
-	BLOCK_DEF(512, HEAP_RT_COUNT512, mod_block512),
-	BLOCK_DEF(1024, HEAP_RT_COUNT1024, mod_block1024),
+/*	BLOCK_DEF(8, HEAP_RT_COUNT8, mod_block8, mod_bitmap8), */
+	BLOCK_DEF(16, HEAP_RT_COUNT16, mod_block16, mod_bitmap16),
+	BLOCK_DEF(32, HEAP_RT_COUNT32, mod_block32, mod_bitmap32),
+	BLOCK_DEF(64, HEAP_RT_COUNT64, mod_block64, mod_bitmap64),
+	BLOCK_DEF(128, HEAP_RT_COUNT128, mod_block128, mod_bitmap128),
+	BLOCK_DEF(256, HEAP_RT_COUNT256, mod_block256, mod_bitmap256),
+	BLOCK_DEF(512, HEAP_RT_COUNT512, mod_block512, mod_bitmap512),
+	BLOCK_DEF(1024, HEAP_RT_COUNT1024, mod_block1024, mod_bitmap1024),
 };
 
 /* Heap blocks for buffers */
-static struct block_hdr buf_block[HEAP_BUFFER_COUNT];
+static struct block_hdr buf_block0[HEAP_BUF_COUNT0];
+static struct block_hdr buf_block1[HEAP_BUF_COUNT1];
+static struct block_hdr buf_block2[HEAP_BUF_COUNT2];
+
+/* Heap block bitmaps for buffers */
+static uint32_t buf_bitmap0[BITMAP_WORDS(HEAP_BUF_COUNT0)];
+static uint32_t buf_bitmap1[BITMAP_WORDS(HEAP_BUF_COUNT1)];
+static uint32_t buf_bitmap2[BITMAP_WORDS(HEAP_BUF_COUNT2)];
 
 /* Heap memory map for buffers */
 static struct block_map buf_heap_map[] = {
-	BLOCK_DEF(HEAP_BUFFER_BLOCK_SIZE, HEAP_BUFFER_COUNT, buf_block),
+	BLOCK_DEF(HEAP_BUF_BLOCK_SIZE0, HEAP_BUF_COUNT0, buf_block0,
+		buf_bitmap0),
+	BLOCK_DEF(HEAP_BUF_BLOCK_SIZE1, HEAP_BUF_COUNT1, buf_block1,
+		buf_bitmap1),
+	BLOCK_DEF(HEAP_BUF_BLOCK_SIZE2, HEAP_BUF_COUNT2, buf_block2,
+		buf_bitmap2),
 };
 
 #if (HEAP_DMA_BUFFER_SIZE > 0)
+/* Heap blocks for DMA buffers */
+static struct block_hdr dma_buf_block[HEAP_DMA_BUFFER_COUNT];
+static uint32_t dma_buf_bitmap[BITMAP_WORDS(HEAP_DMA_BUFFER_COUNT)];
+
 /* Heap memory map for DMA buffers - only used for HW with special DMA memories */
 static struct block_map dma_buf_heap_map[] = {
-	BLOCK_DEF(HEAP_DMA_BUFFER_BLOCK_SIZE, HEAP_DMA_BUFFER_COUNT, buf_block),
+	BLOCK_DEF(HEAP_DMA_BUFFER_BLOCK_SIZE, HEAP_DMA_BUFFER_COUNT,
+		dma_buf_block, dma_buf_bitmap),
 };
 #endif
 
+/* arena chunk - a continuous run of buffer heap blocks */
+struct mm_arena_chunk {
+	struct mm_arena_chunk *next;
+	uint32_t base;		/* chunk start address */
+	uint32_t size;		/* chunk size in bytes */
+	uint32_t used;		/* bytes used from base */
+};
+
+/* pipeline arena - lives at the start of its first chunk */
+struct mm_arena {
+	uint32_t id;		/* pipeline ID */
+	uint32_t refs;		/* pipeline, components and buffers using it */
+	struct mm_arena *next;	/* next arena in memmap.arena_list */
+	struct mm_arena_chunk *chunk;	/* current chunk, head of chunk list */
+	struct mm_arena_chunk first;	/* chunk holding this arena */
+};
+
+/* arenas grow in chunks, larger requests get a chunk of their own */
+#define ARENA_CHUNK_SIZE	HEAP_BUF_BLOCK_SIZE1
+#define ARENA_ALIGN		8
+
 struct mm_heap {
 	uint32_t blocks;
 	struct block_map *map;
@@ -137,6 +214,12 @@ struct mm {
 	struct mm_heap dma;	/* general component DMA buffer heap */
 #endif
 	struct mm_info total;
+
+	/* pipeline arenas */
+	struct mm_arena *arena_list;	/* all arenas */
+	struct mm_arena *arena;		/* arena selected for allocations */
+	uint32_t arena_level;		/* IRQ level that selected arena */
+
 	spinlock_t lock;	/* all allocs and frees are atomic */
 };
 
@@ -176,22 +259,21 @@ struct mm memmap = {
 		HEAP_BUFFER_SIZE + HEAP_DMA_BUFFER_SIZE,},
 };
 
-/* total size of block */
-static inline uint32_t block_get_size(struct block_map *map)
+/* size of block map state in PM context */
+static inline uint32_t map_get_size(struct block_map *map)
 {
-	return sizeof(*map) + map->count *
-		(map->block_size + sizeof(struct block_hdr));
+	return sizeof(*map) + map->count * sizeof(struct block_hdr) +
+		BITMAP_WORDS(map->count) * sizeof(uint32_t);
 }
 
-/* total size of heap */
+/* size of heap in PM context - map state and used memory */
 static inline uint32_t heap_get_size(struct mm_heap *heap)
 {
-	uint32_t size = sizeof(struct mm_heap);
+	uint32_t size = ALIGN_UP(heap->info.used, sizeof(uint32_t));
 	int i;
 
-	for (i = 0; i < heap->blocks; i++) {
-		size += block_get_size(&heap->map[i]);
-	}
+	for (i = 0; i < heap->blocks; i++)
+		size += map_get_size(&heap->map[i]);
 
 	return size;
 }
@@ -207,6 +289,72 @@ static void alloc_memset_region(void *ptr, uint32_t bytes, uint32_t val)
 }
 #endif
 
+/* mark count blocks from start as used in map bitmap */
+static void bitmap_set(struct block_map *map, int start, int count)
+{
+	uint32_t *word = &map->bitmap[start >> 5];
+	uint32_t mask;
+	int bits;
+
+	while (count > 0) {
+		bits = 32 - (start & 31);
+		if (bits > count)
+			bits = count;
+
+		mask = (bits == 32 ? ~0u : ((1u << bits) - 1)) << (start & 31);
+		*word++ |= mask;
+
+		start += bits;
+		count -= bits;
+	}
+}
+
+/* mark count blocks from start as free in map bitmap */
+static void bitmap_clear(struct block_map *map, int start, int count)
+{
+	uint32_t *word = &map->bitmap[start >> 5];
+	uint32_t mask;
+	int bits;
+
+	while (count > 0) {
+		bits = 32 - (start & 31);
+		if (bits > count)
+			bits = count;
+
+		mask = (bits == 32 ? ~0u : ((1u << bits) - 1)) << (start & 31);
+		*word++ &= ~mask;
+
+		start += bits;
+		count -= bits;
+	}
+}
+
+/*
+ * Find first block from start with bitmap bit equal to used. Whole words are
+ * skipped at a time. Returns map->count if there is no such block.
+ */
+static int bitmap_find(struct block_map *map, int start, int used)
+{
+	uint32_t invert = used ? 0 : ~0u;
+	int i = start >> 5, words = BITMAP_WORDS(map->count), bit;
+	uint32_t word;
+
+	if (start >= map->count)
+		return map->count;
+
+	/* mask off blocks before start in first word */
+	word = (map->bitmap[i] ^ invert) & (~0u << (start & 31));
+
+	while (word == 0) {
+		if (++i >= words)
+			return map->count;
+		word = map->bitmap[i] ^ invert;
+	}
+
+	bit = (i << 5) + __builtin_ctz(word);
+	return bit < map->count ? bit : map->count;
+}
+
 /* allocate from system memory pool */
 static void *rmalloc_sys(size_t bytes)
 {
@@ -218,6 +366,9 @@ static void *rmalloc_sys(size_t bytes)
 		trace_mem_error("eMd");
 		panic(PANIC_MEM);
 	}
+	memmap.system.info.used += bytes;
+	memmap.system.info.free -= bytes;
+	memmap.system.info.peak = memmap.system.info.used;
 
 #if DEBUG_BLOCK_ALLOC
 	alloc_memset_region(ptr, bytes, DEBUG_BLOCK_ALLOC_VALUE);
@@ -226,31 +377,42 @@ static void *rmalloc_sys(size_t bytes)
 	return ptr;
 }
 
+/* update high water marks after allocation */
+static inline void alloc_update_peak(struct mm_heap *heap,
+	struct block_map *map)
+{
+	if (map->count - map->free_count > map->peak)
+		map->peak = map->count - map->free_count;
+	if (heap->info.used > heap->info.peak)
+		heap->info.peak = heap->info.used;
+}
+
+/* count failed allocation against map and its heap */
+static inline void alloc_failed(struct mm_heap *heap, struct block_map *map)
+{
+	if (map != NULL && map->failures < 0xffff)
+		map->failures++;
+	heap->info.failures++;
+}
+
 /* allocate single block */
 static void *alloc_block(struct mm_heap *heap, int level, int bflags)
 {
 	struct block_map *map = &heap->map[level];
 	struct block_hdr *hdr = &map->block[map->first_free];
 	void *ptr;
-	int i;
 
 	map->free_count--;
 	ptr = (void *)(map->base + map->first_free * map->block_size);
 	hdr->size = 1;
 	hdr->flags = RFLAGS_USED | bflags;
+	bitmap_set(map, map->first_free, 1);
 	heap->info.used += map->block_size;
 	heap->info.free -= map->block_size;
+	alloc_update_peak(heap, map);
 
 	/* find next free */
-	for (i = map->first_free; i < map->count; ++i) {
-
-		hdr = &map->block[i];
-
-		if (hdr->flags == 0) {
-			map->first_free = i;
-			break;
-		}
-	}
+	map->first_free = bitmap_find(map, map->first_free + 1, 0);
 
 #if DEBUG_BLOCK_ALLOC
 	alloc_memset_region(ptr, map->block_size, DEBUG_BLOCK_ALLOC_VALUE);
@@ -264,71 +426,119 @@ static void *alloc_cont_blocks(struct mm_heap *heap, int level, int bflags,
 	size_t bytes)
 {
 	struct block_map *map = &heap->map[level];
-	struct block_hdr *hdr = &map->block[map->first_free];
+	struct block_hdr *hdr;
 	void *ptr;
-	unsigned int start, current, count = bytes / map->block_size;
-	unsigned int i, remaining = map->count - count, end;
+	unsigned int start, end, current;
+	unsigned int count = bytes / map->block_size;
 
 	if (bytes % map->block_size)
 		count++;
 
-	/* check for continious blocks from "start" */
-	for (start = map->first_free; start < remaining; start++) {
+	if (count > map->free_count)
+		goto not_found;
 
-		/* check that we have enough free blocks from start pos */
-		end = start + count;
-		for (current = start; current < end; current++) {
-			hdr = &map->block[current];
+	/* search runs of free blocks, skipping used runs a word at a time */
+	start = bitmap_find(map, map->first_free, 0);
+	while (start + count <= map->count) {
 
-			/* is block used */
-			if (hdr->flags == RFLAGS_USED)
-				break;
-		}
-
-		/* enough free blocks ? */
-		if (current == end)
+		/* end of this free run */
+		end = bitmap_find(map, start, 1);
+		if (end - start >= count)
 			goto found;
+
+		/* start of next free run */
+		start = bitmap_find(map, end, 0);
 	}
 
-	/* not found */
-	trace_mem_error("eCb");
+not_found:
 	return NULL;
 
 found:
 	/* found some free blocks */
+	end = start + count;
 	map->free_count -= count;
 	ptr = (void *)(map->base + start * map->block_size);
 	hdr = &map->block[start];
 	hdr->size = count;
 	heap->info.used += count * map->block_size;
 	heap->info.free -= count * map->block_size;
+	alloc_update_peak(heap, map);
 
 	/* allocate each block */
 	for (current = start; current < end; current++) {
 		hdr = &map->block[current];
 		hdr->flags = RFLAGS_USED | bflags;
 	}
+	bitmap_set(map, start, count);
 
 	/* do we need to find a new first free block ? */
-	if (start == map->first_free) {
+	if (start == map->first_free)
+		map->first_free = bitmap_find(map, end, 0);
 
-		/* find next free */
-		for (i = map->first_free + count; i < map->count; ++i) {
+#if DEBUG_BLOCK_ALLOC
+	alloc_memset_region(ptr, bytes, DEBUG_BLOCK_ALLOC_VALUE);
+#endif
 
-			hdr = &map->block[i];
+	return ptr;
+}
 
-			if (hdr->flags == 0) {
-				map->first_free = i;
-				break;
+/*
+ * Allocate from the block map with the least waste that can hold the request,
+ * falling back to maps with more waste when a map has no free run long enough.
+ */
+static void *alloc_best_fit(struct mm_heap *heap, int bflags, size_t bytes)
+{
+	struct block_map *map, *fail_map = NULL;
+	uint32_t tried = 0, count, waste, best_waste = 0, fail_waste = 0;
+	int i, best;
+	void *ptr;
+
+	while (1) {
+		best = -1;
+
+		for (i = 0; i < heap->blocks; i++) {
+			map = &heap->map[i];
+			if (tried & (1 << i) || map->count == 0)
+				continue;
+
+			count = (bytes + map->block_size - 1) / map->block_size;
+			if (count > map->count)
+				continue;
+			waste = count * map->block_size - bytes;
+
+			/* failure is counted against best fit map */
+			if (!tried && (fail_map == NULL || waste < fail_waste)) {
+				fail_map = map;
+				fail_waste = waste;
+			}
+
+			if (count > map->free_count)
+				continue;
+
+			if (best < 0 || waste < best_waste) {
+				best = i;
+				best_waste = waste;
 			}
 		}
-	}
 
-#if DEBUG_BLOCK_ALLOC
-	alloc_memset_region(ptr, bytes, DEBUG_BLOCK_ALLOC_VALUE);
-#endif
+		if (best < 0)
+			break;
 
-	return ptr;
+		tried |= 1 << best;
+		map = &heap->map[best];
+
+		if (bytes <= map->block_size)
+			return alloc_block(heap, best, bflags);
+
+		ptr = alloc_cont_blocks(heap, best, bflags, bytes);
+		if (ptr != NULL)
+			return ptr;
+	}
+
+	trace_mem_error("eMb");
+	trace_value(bytes);
+	alloc_failed(heap, fail_map);
+	return NULL;
 }
 
 /* free block(s) */
@@ -337,7 +547,7 @@ static void free_block(struct mm_heap *heap, void *ptr)
 	struct mm_heap * mm_heap;
 	struct block_map * block_map;
 	struct block_hdr *hdr;
-	int i, block, array_size;
+	int i, block, count, array_size;
 
 	/* sanity check */
 	if (ptr == NULL)
@@ -362,10 +572,11 @@ static void free_block(struct mm_heap *heap, void *ptr)
 		return;
 
 	/* find block that ptr belongs to */
-	for (i = 0; i < array_size - 1; i ++) {
+	for (i = 0; i < array_size; i ++) {
 
 		/* is ptr in this block */
-		if ((uint32_t)ptr < mm_heap->map[i + 1].base)
+		if ((uint32_t)ptr < mm_heap->map[i].base +
+			mm_heap->map[i].block_size * mm_heap->map[i].count)
 			goto found;
 	}
 
@@ -382,13 +593,15 @@ found:
 	hdr = &block_map->block[block];
 
 	/* free block header and continious blocks */
-	for (i = block; i < block + hdr->size; i++) {
+	count = hdr->size;
+	bitmap_clear(block_map, block, count);
+	for (i = block; i < block + count; i++) {
 		hdr = &block_map->block[i];
 		hdr->size = 0;
 		hdr->flags = 0;
 		block_map->free_count++;
-		heap->info.used -= block_map->block_size;
-		heap->info.free += block_map->block_size;
+		mm_heap->info.used -= block_map->block_size;
+		mm_heap->info.free += block_map->block_size;
 	}
 
 	/* set first free */
@@ -400,9 +613,187 @@ found:
 #endif
 }
 
+/* allocate arena chunk memory from the buffer heap */
+static void *arena_blocks(size_t bytes, uint32_t *size)
+{
+	*size = bytes;
+	return alloc_best_fit(&memmap.buffer, RFLAGS_ARENA, bytes);
+}
+
+/* bump allocate from arena */
+static void *arena_alloc(struct mm_arena *arena, size_t bytes, uint32_t align)
+{
+	struct mm_arena_chunk *chunk;
+	uint32_t start, size;
+	void *ptr;
+
+	/* large requests get their own chunk so the current one is kept */
+	if (bytes > ARENA_CHUNK_SIZE / 2) {
+		chunk = arena_alloc(arena, sizeof(*chunk), ARENA_ALIGN);
+		if (chunk == NULL)
+			return NULL;
+
+		ptr = arena_blocks(bytes, &chunk->size);
+		if (ptr == NULL)
+			return NULL;
+
+		chunk->base = (uint32_t)ptr;
+		chunk->used = chunk->size;
+		chunk->next = arena->chunk->next;
+		arena->chunk->next = chunk;
+		return ptr;
+	}
+
+	chunk = arena->chunk;
+	start = ALIGN_UP(chunk->base + chunk->used, align);
+
+	/* start a new chunk if current one is full */
+	if (start + bytes > chunk->base + chunk->size) {
+		chunk = arena_blocks(ARENA_CHUNK_SIZE, &size);
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->base = (uint32_t)chunk;
+		chunk->size = size;
+		chunk->used = sizeof(*chunk);
+		chunk->next = arena->chunk;
+		arena->chunk = chunk;
+		start = ALIGN_UP(chunk->base + chunk->used, align);
+	}
+
+	chunk->used = start + bytes - chunk->base;
+	return (void *)start;
+}
+
+/* is ptr inside buffer heap blocks owned by an arena */
+static int arena_owns(void *ptr)
+{
+	struct block_map *map;
+	int i;
+
+	if ((uint32_t)ptr < memmap.buffer.heap ||
+		(uint32_t)ptr >= memmap.buffer.heap + memmap.buffer.size)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(buf_heap_map); i++) {
+		map = &memmap.buffer.map[i];
+
+		/* every block of an arena chunk is tagged */
+		if ((uint32_t)ptr < map->base + map->block_size * map->count)
+			return map->block[((uint32_t)ptr - map->base) /
+				map->block_size].flags & RFLAGS_ARENA;
+	}
+
+	return 0;
+}
+
+/* arena selected for allocations in this context */
+static inline struct mm_arena *arena_current(void)
+{
+	if (memmap.arena != NULL &&
+		memmap.arena_level == interrupt_get_level())
+		return memmap.arena;
+
+	return NULL;
+}
+
+/* get reference to pipeline arena, creating it on first use */
+struct mm_arena *arena_get(uint32_t id)
+{
+	struct mm_arena *arena;
+	uint32_t flags, size;
+
+	spin_lock_irq(&memmap.lock, flags);
+
+	for (arena = memmap.arena_list; arena != NULL; arena = arena->next) {
+		if (arena->id == id) {
+			arena->refs++;
+			goto out;
+		}
+	}
+
+	arena = arena_blocks(ARENA_CHUNK_SIZE, &size);
+	if (arena == NULL) {
+		trace_mem_error("eAn");
+		goto out;
+	}
+
+	arena->id = id;
+	arena->refs = 1;
+	arena->first.next = NULL;
+	arena->first.base = (uint32_t)arena;
+	arena->first.size = size;
+	arena->first.used = sizeof(*arena);
+	arena->chunk = &arena->first;
+	arena->next = memmap.arena_list;
+	memmap.arena_list = arena;
+
+out:
+	spin_unlock_irq(&memmap.lock, flags);
+	return arena;
+}
+
+/* put arena reference, all arena memory is freed with the last one */
+void arena_put(struct mm_arena *arena)
+{
+	struct mm_arena **prev;
+	struct mm_arena_chunk **link, *chunk, *next;
+	uint32_t flags;
+
+	if (arena == NULL)
+		return;
+
+	spin_lock_irq(&memmap.lock, flags);
+
+	if (--arena->refs > 0)
+		goto out;
+
+	for (prev = &memmap.arena_list; *prev != arena; prev = &(*prev)->next)
+		;
+	*prev = arena->next;
+
+	/* large allocations first, their descriptors live in the other
+	 * chunks so unlink them while those are still allocated */
+	link = &arena->chunk;
+	while ((chunk = *link) != NULL) {
+		if (chunk->base != (uint32_t)chunk && chunk != &arena->first) {
+			*link = chunk->next;
+			free_block(&memmap.buffer, (void *)chunk->base);
+		} else
+			link = &chunk->next;
+	}
+
+	/* each chunk left holds its own descriptor, the arena is freed last */
+	for (chunk = arena->chunk; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		if (chunk != &arena->first)
+			free_block(&memmap.buffer, chunk);
+	}
+	free_block(&memmap.buffer, arena);
+
+out:
+	spin_unlock_irq(&memmap.lock, flags);
+}
+
+/* select arena for RZONE_RUNTIME allocations, returns previous arena */
+struct mm_arena *arena_select(struct mm_arena *arena)
+{
+	struct mm_arena *prev;
+	uint32_t flags;
+
+	spin_lock_irq(&memmap.lock, flags);
+	prev = memmap.arena;
+	memmap.arena = arena;
+	memmap.arena_level = interrupt_get_level();
+	spin_unlock_irq(&memmap.lock, flags);
+
+	return prev;
+}
+
 /* allocate single block for runtime */
 static void *rmalloc_runtime(int bflags, size_t bytes)
 {
+	struct block_map *map = NULL;
 	int i;
 
 	for (i = 0; i < ARRAY_SIZE(rt_heap_map); i ++) {
@@ -412,8 +803,12 @@ static void *rmalloc_runtime(int bflags, size_t bytes)
 			continue;
 
 		/* does block have free space */
-		if (rt_heap_map[i].free_count == 0)
+		if (rt_heap_map[i].free_count == 0) {
+			/* failure is counted against best fit map */
+			if (map == NULL)
+				map = &rt_heap_map[i];
 			continue;
+		}
 
 		/* free block space exists */
 		return alloc_block(&memmap.runtime, i, bflags);
@@ -422,11 +817,13 @@ static void *rmalloc_runtime(int bflags, size_t bytes)
 	trace_mem_error("eMm");
 	trace_value(bytes);
 	trace_value(bflags);
+	alloc_failed(&memmap.runtime, map);
 	return NULL;
 }
 
 void *rmalloc(int zone, int bflags, size_t bytes)
 {
+	struct mm_arena *arena;
 	uint32_t flags;
 	void *ptr = NULL;
 
@@ -437,7 +834,11 @@ void *rmalloc(int zone, int bflags, size_t bytes)
 		ptr = rmalloc_sys(bytes);
 		break;
 	case RZONE_RUNTIME:
-		ptr = rmalloc_runtime(bflags, bytes);
+		arena = arena_current();
+		if (arena != NULL)
+			ptr = arena_alloc(arena, bytes, ARENA_ALIGN);
+		if (ptr == NULL)
+			ptr = rmalloc_runtime(bflags, bytes);
 		break;
 	default:
 		trace_mem_error("eMz");
@@ -460,61 +861,33 @@ void *rzalloc(int zone, int bflags, size_t bytes)
 	return ptr;
 }
 
-/* allocates continuous buffer on 1k boundary */
+/* allocates continuous cache line aligned buffer */
 void *rballoc(int zone, int bflags, size_t bytes)
 {
-	struct block_map * block_map = buf_heap_map;
 	struct mm_heap * mm_heap = &memmap.buffer;
-	int i, array_size = ARRAY_SIZE(buf_heap_map);
+	struct mm_arena *arena;
 	uint32_t flags;
 	void *ptr = NULL;
 
 #if (HEAP_DMA_BUFFER_SIZE > 0)
-	if (bflags & RFLAGS_DMA) {
+	if (bflags & RFLAGS_DMA)
 		mm_heap = &memmap.dma;
-		block_map = dma_buf_heap_map;
-		array_size = ARRAY_SIZE(dma_buf_heap_map);
-	}
 #endif
 	spin_lock_irq(&memmap.lock, flags);
 
-	/* will request fit in single block */
-	for (i = 0; i < array_size; i++) {
-
-		trace_value(block_map[i].block_size);
-		/* is block big enough */
-		if (block_map[i].block_size < bytes)
-			continue;
-
-		/* does block have free space */
-		if (block_map[i].free_count == 0)
-			continue;
-
-		/* allocate block */
-		ptr = alloc_block(mm_heap, i, bflags);
-		goto out;
-	}
-
-	/* request spans > 1 block */
-
-	/* only 1 choice for block size */
-	if (array_size == 1) {
-		ptr = alloc_cont_blocks(mm_heap, 0, bflags, bytes);
-		goto out;
-	} else {
-
-		/* find best block size for request */
-		for (i = 0; i < array_size; i++) {
-
-			/* allocate is block size smaller than request */
-			if (block_map[i].block_size < bytes)
-				alloc_cont_blocks(mm_heap, i, bflags,
-					bytes);
+	/* pipeline buffers come from the selected arena */
+	if (zone == RZONE_RUNTIME && !(bflags & RFLAGS_DMA)) {
+		arena = arena_current();
+		if (arena != NULL) {
+			/* whole lines so no other data shares the buffer lines */
+			ptr = arena_alloc(arena, ALIGN_UP(bytes, DCACHE_LINE_SIZE),
+				DCACHE_LINE_SIZE);
+			if (ptr != NULL)
+				goto out;
 		}
 	}
 
-	ptr = alloc_cont_blocks(mm_heap, array_size - 1,
-		bflags, bytes);
+	ptr = alloc_best_fit(mm_heap, bflags, bytes);
 
 out:
 	spin_unlock_irq(&memmap.lock, flags);
@@ -526,7 +899,11 @@ void rfree(void *ptr)
 	uint32_t flags;
 
 	spin_lock_irq(&memmap.lock, flags);
-	free_block(&memmap.runtime, ptr);
+
+	/* arena memory is only freed with its arena */
+	if (!arena_owns(ptr))
+		free_block(&memmap.runtime, ptr);
+
 	spin_unlock_irq(&memmap.lock, flags);
 }
 
@@ -535,23 +912,112 @@ void rbfree(void *ptr)
 	uint32_t flags;
 
 	spin_lock_irq(&memmap.lock, flags);
-	free_block(&memmap.buffer, ptr);
+
+	/* arena memory is only freed with its arena */
+	if (!arena_owns(ptr))
+		free_block(&memmap.buffer, ptr);
+
 	spin_unlock_irq(&memmap.lock, flags);
 }
 
-uint32_t mm_pm_context_size(void)
+/* largest run of free blocks in map */
+static uint32_t map_largest_free(struct block_map *map)
 {
-	uint32_t size;
+	uint32_t largest = 0;
+	int start, end;
+
+	start = bitmap_find(map, map->first_free, 0);
+	while (start < map->count) {
+		end = bitmap_find(map, start, 1);
+		if (end - start > largest)
+			largest = end - start;
+		start = bitmap_find(map, end, 0);
+	}
 
-	/* calc context size for each area  */
-	size = memmap.buffer.info.used;
-	size += memmap.runtime.info.used;
-	size += memmap.system.info.used;
+	return largest;
+}
 
-	/* add memory maps */
-	size += heap_get_size(&memmap.buffer);
-	size += heap_get_size(&memmap.runtime);
-	size += heap_get_size(&memmap.system);
+/* get heap and block map statistics for zone */
+int mm_heap_info(int zone, int bflags, struct mm_info *info,
+	struct mm_map_info *map, int maps)
+{
+	struct mm_heap *heap;
+	struct block_map *block_map;
+	uint32_t flags, largest;
+	int i;
+
+	switch (zone) {
+	case RZONE_SYS:
+		heap = &memmap.system;
+		break;
+	case RZONE_RUNTIME:
+		heap = &memmap.runtime;
+		break;
+	case RZONE_BUFFER:
+		heap = &memmap.buffer;
+		if (bflags & RFLAGS_DMA) {
+#if (HEAP_DMA_BUFFER_SIZE > 0)
+			heap = &memmap.dma;
+#else
+			return -ENODEV;
+#endif
+		}
+		break;
+	default:
+		trace_mem_error("eMi");
+		return -EINVAL;
+	}
+
+	spin_lock_irq(&memmap.lock, flags);
+
+	*info = heap->info;
+
+	/* system heap has no map, its free space is continuous */
+	if (heap->blocks == 0)
+		info->largest_free = info->free;
+	else
+		info->largest_free = 0;
+
+	for (i = 0; i < heap->blocks; i++) {
+		block_map = &heap->map[i];
+
+		largest = map_largest_free(block_map);
+		if (largest * block_map->block_size > info->largest_free)
+			info->largest_free = largest * block_map->block_size;
+
+		if (i >= maps)
+			continue;
+
+		map[i].largest_free = largest;
+		map[i].block_size = block_map->block_size;
+		map[i].count = block_map->count;
+		map[i].used = block_map->count - block_map->free_count;
+		map[i].peak = block_map->peak;
+		map[i].failures = block_map->failures;
+	}
+
+	spin_unlock_irq(&memmap.lock, flags);
+	return heap->blocks < maps ? heap->blocks : maps;
+}
+
+/* heaps in PM context order */
+static struct mm_heap *pm_heaps[] = {
+	&memmap.system,
+	&memmap.runtime,
+	&memmap.buffer,
+#if (HEAP_DMA_BUFFER_SIZE > 0)
+	&memmap.dma,
+#endif
+};
+
+uint32_t mm_pm_context_size(void)
+{
+	uint32_t size = sizeof(memmap);
+	int i;
+
+	/* calc context size for each heap */
+	for (i = 0; i < ARRAY_SIZE(pm_heaps); i++)
+		size += heap_get_size(pm_heaps[i]);
 
 	/* recalc totals */
 	memmap.total.free = memmap.buffer.info.free +
@@ -562,42 +1028,163 @@ uint32_t mm_pm_context_size(void)
 	return size;
 }
 
+/*
+ * Find a free run of buffer heap blocks to stage the system heap in. It is
+ * not allocated, so the block maps and the context size are not changed.
+ */
+static void *mm_pm_bounce(uint32_t bytes)
+{
+	struct block_map *map;
+	int i, start, end;
+
+	for (i = 0; i < memmap.buffer.blocks; i++) {
+		map = &memmap.buffer.map[i];
+
+		start = bitmap_find(map, 0, 0);
+		while (start < map->count) {
+			end = bitmap_find(map, start, 1);
+			if ((end - start) * map->block_size >= bytes)
+				return (void *)(map->base +
+					start * map->block_size);
+
+			start = bitmap_find(map, end, 0);
+		}
+	}
+
+	trace_mem_error("ePb");
+	trace_value(bytes);
+	return NULL;
+}
+
+/*
+ * Copy heap context between DSP and host SG buffer. Save and restore use the
+ * same order so restore can walk the block maps it has just restored :-
+ *
+ * 1) memmap.
+ * 2) Block map, block headers and bitmap of every heap block map.
+ * 3) Each run of used blocks in every block map, adjacent allocations are
+ *    copied in a single DMA transfer.
+ * 4) Used part of the system heap, staged in free buffer heap blocks.
+ *
+ * The system heap holds the DMA driver state used by the copy, so it is
+ * staged before the first transfer on save and written last by the CPU on
+ * restore once no DMA channel is held. Single block DMA transfers allocate no
+ * descriptors, so the heaps do not change while they are copied.
+ *
+ * Returns the context size in bytes or a negative error.
+ */
+static int mm_pm_context_copy(struct dma_sg_config *sg,
+	int (*copy)(struct dma_sg_config *sg, int32_t offset, void *ptr,
+	int32_t size), int save)
+{
+	struct mm_heap *heap;
+	struct block_map *map;
+	void *bounce = NULL;
+	uint32_t sys_size, flags;
+	int32_t offset;
+	int i, j, start, end;
+
+	/* system heap is used from its base upwards */
+	if (save) {
+		sys_size = ALIGN_UP(memmap.system.info.used, sizeof(uint32_t));
+		bounce = mm_pm_bounce(sys_size);
+		if (bounce == NULL)
+			return -ENOMEM;
+		memcpy(bounce, (void *)HEAP_SYSTEM_BASE, sys_size);
+	}
+
+	/* heap state */
+	offset = copy(sg, 0, &memmap, sizeof(memmap));
+	if (offset < 0)
+		return offset;
+
+	/* block maps */
+	for (i = 0; i < ARRAY_SIZE(pm_heaps); i++) {
+		heap = pm_heaps[i];
+
+		for (j = 0; j < heap->blocks; j++) {
+			map = &heap->map[j];
+
+			offset = copy(sg, offset, map, sizeof(*map));
+			if (offset < 0)
+				return offset;
+
+			offset = copy(sg, offset, map->block,
+				map->count * sizeof(struct block_hdr));
+			if (offset < 0)
+				return offset;
+
+			offset = copy(sg, offset, map->bitmap,
+				BITMAP_WORDS(map->count) * sizeof(uint32_t));
+			if (offset < 0)
+				return offset;
+		}
+	}
+
+	/* used block runs */
+	for (i = 0; i < ARRAY_SIZE(pm_heaps); i++) {
+		heap = pm_heaps[i];
+
+		for (j = 0; j < heap->blocks; j++) {
+			map = &heap->map[j];
+
+			start = bitmap_find(map, 0, 1);
+			while (start < map->count) {
+				end = bitmap_find(map, start, 0);
+
+				offset = copy(sg, offset,
+					(void *)(map->base +
+					start * map->block_size),
+					(end - start) * map->block_size);
+				if (offset < 0)
+					return offset;
+
+				start = bitmap_find(map, end, 1);
+			}
+		}
+	}
+
+	/* restored buffer maps have the same free runs as when saved */
+	if (!save) {
+		sys_size = ALIGN_UP(memmap.system.info.used, sizeof(uint32_t));
+		bounce = mm_pm_bounce(sys_size);
+		if (bounce == NULL)
+			return -ENOMEM;
+	}
+
+	offset = copy(sg, offset, bounce, sys_size);
+	if (offset < 0)
+		return offset;
+
+	if (!save) {
+		flags = interrupt_global_disable();
+		memcpy((void *)HEAP_SYSTEM_BASE, bounce, sys_size);
+		interrupt_global_enable(flags);
+	}
+
+	return offset;
+}
+
 /*
  * Save the DSP memories that are in use the system and modules. All pipeline and modules
  * must be disabled before calling this functions. No allocations are permitted after
  * calling this and before calling restore.
+ *
+ * The host SG elems in sg must not be allocated from the heaps, they are
+ * still used while the heaps are copied.
  */
 int mm_pm_context_save(struct dma_sg_config *sg)
 {
 	uint32_t used;
-	int32_t offset = 0, ret;
 
 	/* first make sure SG buffer has enough space on host for DSP context */
 	used = mm_pm_context_size();
-	if (used > dma_sg_get_size(sg))
+	if (used > dma_sg_get_size(sg)) {
+		trace_mem_error("ePs");
 		return -EINVAL;
+	}
 
-	/* copy memory maps to SG */
-	ret = dma_copy_to_host(sg, offset,
-		(void *)&memmap, sizeof(memmap));
-	if (ret < 0)
-		return ret;
-
-	/* copy system memory contents to SG */
-	ret = dma_copy_to_host(sg, offset + ret,
-		(void *)memmap.system.heap, (int32_t)(memmap.system.size));
-	if (ret < 0)
-		return ret;
-
-	/* copy module memory contents to SG */
-	// TODO: iterate over module block map and copy contents of each block
-	// to the host.
-
-	/* copy buffer memory contents to SG */
-	// TODO: iterate over buffer block map and copy contents of each block
-	// to the host.
-
-	return ret;
+	return mm_pm_context_copy(sg, dma_copy_to_host, 1);
 }
 
 /*
@@ -606,28 +1193,16 @@ int mm_pm_context_save(struct dma_sg_config *sg)
  */
 int mm_pm_context_restore(struct dma_sg_config *sg)
 {
-	int32_t offset = 0, ret;
-
-	/* copy memory maps from SG */
-	ret = dma_copy_from_host(sg, offset,
-		(void *)&memmap, sizeof(memmap));
-	if (ret < 0)
-		return ret;
+	int ret;
 
-	/* copy system memory contents from SG */
-	ret = dma_copy_to_host(sg, offset + ret,
-		(void *)memmap.system.heap, (int32_t)(memmap.system.size));
-	if (ret < 0)
+	ret = mm_pm_context_copy(sg, dma_copy_from_host, 0);
+	if (ret < 0) {
+		trace_mem_error("ePr");
 		return ret;
+	}
 
-	/* copy module memory contents from SG */
-	// TODO: iterate over module block map and copy contents of each block
-	// to the host. This is the same block order used by the context store
-
-	/* copy buffer memory contents from SG */
-	// TODO: iterate over buffer block map and copy contents of each block
-	// to the host. This is the same block order used by the context store
-
+	/* lock state is not part of the context */
+	spinlock_init(&memmap.lock);
 	return 0;
 }
 
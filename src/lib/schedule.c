@@ -42,6 +42,8 @@
 #include <reef/work.h>
 #include <platform/timer.h>
 #include <platform/clk.h>
+#include <platform/platform.h>
+#include <reef/cpu.h>
 #include <reef/audio/component.h>
 #include <reef/audio/pipeline.h>
 #include <arch/task.h>
@@ -50,13 +52,86 @@ struct schedule_data {
 	spinlock_t lock;
 	struct list_item list;	/* list of tasks in priority queue */
 	uint32_t clock;
+	int core;		/* core this scheduler runs tasks on */
+	uint32_t load;		/* load reserved by pipelines in kcps */
 	struct work work;
+	uint32_t running;	/* scheduler IRQ handler is running */
+	uint32_t rerun;		/* schedule requested while running */
+
+	/* schedule requests batched by IRQ handlers */
+	uint32_t batch;		/* batch nesting depth */
+	uint32_t batch_pending;	/* requests in current batch */
+	uint32_t batch_count;	/* total batches with requests */
+	uint32_t batch_coalesced; /* total requests saved by batching */
 };
 
-static struct schedule_data *sch;
+/* each core has its own scheduler instance */
+static struct schedule_data *sch_core[PLATFORM_CORE_COUNT];
+
+static inline struct schedule_data *sch_get(int core)
+{
+	if (core >= PLATFORM_CORE_COUNT)
+		return NULL;
+
+	return sch_core[core];
+}
+
+/*
+ * Run the scheduler on this core. If the request is made while the scheduler
+ * IRQ handler is running on this core, e.g. from an IRQ that preempted it,
+ * the running scheduler just makes another pass before it returns. If we are
+ * already at the scheduler IRQ level, e.g. completing a task at the same
+ * level, the scheduler IRQ could not preempt us anyway so it is called
+ * directly. Saves a DSP context switch. Otherwise the scheduler IRQ is raised.
+ */
+static void schedule_local(void)
+{
+	struct schedule_data *sch = sch_get(cpu_get_id());
+	uint32_t flags;
+
+	spin_lock_irq(&sch->lock, flags);
+	if (sch->running) {
+		sch->rerun = 1;
+		spin_unlock_irq(&sch->lock, flags);
+		return;
+	}
+	spin_unlock_irq(&sch->lock, flags);
+
+	if (interrupt_get_level() ==
+		interrupt_get_irq_level(PLATFORM_SCHEDULE_IRQ))
+		scheduler_run(NULL);
+	else
+		interrupt_set(PLATFORM_SCHEDULE_IRQ);
+}
+
+/* run the scheduler on core */
+static void schedule_core(int core)
+{
+	struct schedule_data *sch;
+	uint32_t flags;
+
+	/* the scheduler is run in IRQ context on the task core */
+	if (core == cpu_get_id()) {
+		sch = sch_get(core);
+
+		/* run scheduler once at end of batch */
+		if (sch != NULL && sch->batch) {
+			spin_lock_irq(&sch->lock, flags);
+			sch->batch_pending++;
+			spin_unlock_irq(&sch->lock, flags);
+			return;
+		}
+
+		schedule_local();
+	} else
+		platform_idc_schedule(core);
+}
 
 #define SLOT_ALIGN_TRIES	10
 
+/* max number of periods a late periodic task can catch up */
+#define PERIOD_CATCHUP_MAX	2
+
 /*
  * Simple rescheduler to calculate tasks new start time and deadline if
  * prevoius deadline was missed. Tries to align at first with current task
@@ -84,68 +159,123 @@ static inline void edf_reschedule(struct task *task, uint64_t current)
 	task->deadline = task->start + delta;
 }
 
+/* can late periodic task run now and catch up with its period ? */
+static inline int edf_period_catchup(struct task *task, uint64_t current)
+{
+	/* not started yet, only missed due to task length */
+	if (current < task->start)
+		return 1;
+
+	return task->late == TASK_LATE_CATCHUP &&
+		current - task->start <= task->period * PERIOD_CATCHUP_MAX;
+}
+
+/*
+ * Skip late periods of a periodic task. The task is moved to the first
+ * period that starts after current so it stays aligned with its timebase.
+ */
+static inline void edf_period_skip(struct task *task, uint64_t current)
+{
+	uint64_t skip = 1;
+
+	if (current >= task->start)
+		skip += (current - task->start) / task->period;
+
+	task->start += skip * task->period;
+	task->deadline = task->start + task->period_deadline;
+	task->skipped += skip;
+}
+
+/* tasks are ordered by deadline including the recent length of the task */
+static inline uint64_t edf_key(struct task *task)
+{
+	return task->deadline - task->peak_rtime;
+}
+
+/*
+ * Insert task into the deadline ordered queue. Periodic tasks are normally
+ * queued with the latest deadline so search backwards from the tail.
+ */
+static void edf_insert(struct schedule_data *sch, struct task *task)
+{
+	struct task *t;
+	struct list_item *tlist;
+	uint64_t key = edf_key(task);
+
+	list_for_item_prev(tlist, &sch->list) {
+		t = container_of(tlist, struct task, list);
+
+		/* insert after last task with same or earlier deadline */
+		if (edf_key(t) <= key) {
+			list_item_prepend(&task->list, tlist);
+			return;
+		}
+	}
+
+	/* earliest deadline, so task is at the head */
+	list_item_prepend(&task->list, &sch->list);
+}
+
 /*
- * Find the first non running task with the earliest deadline.
+ * Get the queued task with the earliest deadline. The queue is kept in
+ * deadline order so this is the head of the queue, unless any tasks at the
+ * head have missed their deadline. Missed tasks are rescheduled and re-queued.
  * TODO: Reduce cache invalidations by checking if the currently
  * running task AND the earliest queued task will both complete before their
  * deadlines. If so, then schedule the earlier queued task after the currently
  * running task has completed.
  */
-static inline struct task *edf_get_next(uint64_t current,
-	struct task *ignore)
+static inline struct task *edf_get_next(struct schedule_data *sch,
+	uint64_t current)
 {
-	struct task *task, *next_task = NULL;
+	struct task *task;
+	struct list_item missed;
 	struct list_item *clist, *tlist;
-	uint64_t next_delta = UINT64_MAX, delta, deadline;
-	int reschedule = 0;
- 
+
 	/* any tasks in the scheduler ? */
 	if (list_is_empty(&sch->list))
 		return NULL;
 
-	/* check every queued or running task in list */
+	list_init(&missed);
+
+	/* remove all tasks that have missed scheduling from the head */
 	list_for_item_safe(clist, tlist, &sch->list) {
 		task = container_of(clist, struct task, list);
 
-		/* only check queued tasks */
-		if (task->state != TASK_STATE_QUEUED)
-			continue;
-
-		/* include the length of task in deadline calc */
-		deadline = task->deadline - task->max_rtime;
-
-		/* get earliest deadline */
-		if (current < deadline) {
-			delta = deadline - current;
-
-			if (delta < next_delta) {
-				next_delta = delta;
-				next_task = task;
-			}
-
-		} else {
-			/* missed scheduling - will be rescheduled */
-			trace_pipe("ed!");
-
-			/* have we already tried to rescheule ? */
-			if (reschedule++)
-				edf_reschedule(task, current);
-			else {
-				/* reschedule failed */
-				list_item_del(&task->list);
-				task->state = TASK_STATE_CANCEL;
-			}
-		}
+		if (current < edf_key(task))
+			break;
+
+		/* late periodic task can run now if it can catch up */
+		if (task->period && edf_period_catchup(task, current))
+			break;
+
+		/* missed scheduling - will be rescheduled */
+		trace_pipe("ed!");
+		list_item_del(&task->list);
+		list_item_append(&task->list, &missed);
 	}
 
-	return next_task;
+	/* and re-queue them at their new deadlines */
+	list_for_item_safe(clist, tlist, &missed) {
+		task = container_of(clist, struct task, list);
+
+		if (task->period)
+			edf_period_skip(task, current);
+		else
+			edf_reschedule(task, current);
+		edf_insert(sch, task);
+	}
+
+	return list_first_item(&sch->list, struct task, list);
 }
 
 /* work set in the future when next task can be scheduled */
 static uint32_t sch_work(void *data, uint32_t delay)
 {
+	struct schedule_data *sch = data;
+
 	tracev_pipe("wrk");
-	schedule();
+	schedule_core(sch->core);
 	return 0;
 }
 
@@ -157,6 +287,7 @@ static uint32_t sch_work(void *data, uint32_t delay)
  */
 struct task *schedule_edf(void)
 {
+	struct schedule_data *sch = sch_get(cpu_get_id());
 	struct task *task, *next_plus1_task = NULL;
 	uint64_t current;
 	uint32_t flags;
@@ -170,27 +301,31 @@ struct task *schedule_edf(void)
 	current = platform_timer_get(platform_timer);
 
 	/* get next task to be scheduled */
-	task = edf_get_next(current, NULL);
-
-	spin_unlock_irq(&sch->lock, flags);
-	interrupt_clear(PLATFORM_SCHEDULE_IRQ);
-
-	/* any tasks ? */
-	if (task == NULL)
-		return NULL;
+	task = edf_get_next(sch, current);
 
 	/* can task be started now ? */
-	if (task->start > current) {
+	if (task == NULL || task->start > current) {
 		/* no, then schedule wake up */
 		next_plus1_task = task;
+		task = NULL;
 	} else {
-		/* yes, get next task and run this one now */
-		next_plus1_task = edf_get_next(current, task);
+		/* yes, remove it from the queue and get next task */
+		list_item_del(&task->list);
+		task->state = TASK_STATE_RUNNING;
+
+		/* periodic tasks stay anchored to their timebase, actual
+		 * dispatch time is kept in run_start */
+		if (!task->period)
+			task->start = current;
+		next_plus1_task = edf_get_next(sch, current);
+	}
 
-		/* run current task */
-		task->start = current;
+	spin_unlock_irq(&sch->lock, flags);
+	interrupt_clear(PLATFORM_SCHEDULE_IRQ);
+
+	/* run current task */
+	if (task)
 		arch_run_task(task);
-	}
 
 	/* teall caller about next task (after current) */
 	return next_plus1_task;
@@ -199,21 +334,23 @@ struct task *schedule_edf(void)
 /* delete task from scheduler */
 int schedule_task_del(struct task *task)
 {
+	struct schedule_data *sch = sch_get(task->core);
 	uint32_t flags;
 	int ret = 0;
 
 	tracev_pipe("del");
 
-	/* add task to list */
 	spin_lock_irq(&sch->lock, flags);
 
-	/* is task already running ? */
+	/* is task already running ? then stop it when it completes */
 	if (task->state == TASK_STATE_RUNNING) {
-		ret = -EAGAIN;
+		task->state = TASK_STATE_CANCEL;
 		goto out;
 	}
 
-	list_item_del(&task->list);
+	/* remove task from queue */
+	if (task->state == TASK_STATE_QUEUED)
+		list_item_del(&task->list);
 	task->state = TASK_STATE_COMPLETED;
 
 out:
@@ -231,20 +368,28 @@ out:
  */
 void schedule_task(struct task *task, uint64_t start, uint64_t deadline)
 {
+	struct schedule_data *sch = sch_get(task->core);
 	uint32_t flags;
 	uint64_t current;
 
 	tracev_pipe("ad!");
 
-	spin_lock_irq(&sch->lock, flags);
-
-	/* is task already running ? - not enough MIPS to complete ? */
-	if (task->state == TASK_STATE_RUNNING) {
-		trace_pipe("tsk");
-		spin_unlock_irq(&sch->lock, flags);
+	/* is there a scheduler running on the task core ? */
+	if (sch == NULL) {
+		trace_pipe_error("eSc");
+		trace_value(task->core);
 		return;
 	}
 
+	spin_lock_irq(&sch->lock, flags);
+
+	/* re-queue task if already queued, a running task can queue itself */
+	if (task->state == TASK_STATE_QUEUED)
+		list_item_del(&task->list);
+
+	/* task is no longer periodic */
+	task->period = 0;
+
 	/* get the current time */
 	current = platform_timer_get(platform_timer);
 
@@ -258,36 +403,190 @@ void schedule_task(struct task *task, uint64_t start, uint64_t deadline)
 	/* calculate deadline - TODO: include MIPS */
 	task->deadline = task->start + clock_us_to_ticks(sch->clock, deadline);
 
-	/* add task to list */
-	list_item_append(&task->list, &sch->list);
+	/* add task to queue in deadline order */
+	edf_insert(sch, task);
+	task->state = TASK_STATE_QUEUED;
+	spin_unlock_irq(&sch->lock, flags);
+
+	/* rerun scheduler on the task core */
+	schedule_core(task->core);
+}
+
+/*
+ * Add a periodic task to the scheduler. The task runs every period
+ * microseconds and must complete within deadline microseconds of each period
+ * start. Period start times are anchored to the scheduler clock timebase and
+ * never drift, so late periods are either caught up or skipped as per late.
+ * The task is re-queued for its next period until it's deleted.
+ */
+void schedule_task_periodic(struct task *task, uint64_t period,
+	uint64_t deadline, uint32_t late)
+{
+	struct schedule_data *sch = sch_get(task->core);
+	uint32_t flags;
+	uint64_t current;
+
+	tracev_pipe("adp");
+
+	/* is there a scheduler running on the task core ? */
+	if (sch == NULL || period == 0) {
+		trace_pipe_error("eSp");
+		trace_value(task->core);
+		return;
+	}
+
+	spin_lock_irq(&sch->lock, flags);
+
+	if (task->state == TASK_STATE_QUEUED)
+		list_item_del(&task->list);
+
+	task->period = clock_us_to_ticks(sch->clock, period);
+	task->period_deadline = clock_us_to_ticks(sch->clock, deadline);
+	task->late = late;
+
+	/* start at the next period boundary of the timebase */
+	current = platform_timer_get(platform_timer);
+	task->start = current - current % task->period + task->period;
+	task->deadline = task->start + task->period_deadline;
+
+	edf_insert(sch, task);
 	task->state = TASK_STATE_QUEUED;
 	spin_unlock_irq(&sch->lock, flags);
 
-	/* rerun scheduler */
-	schedule();
+	/* rerun scheduler on the task core */
+	schedule_core(task->core);
 }
 
-/* Remove a task from the scheduler when complete */
+/* Task has started running - called by arch task handler */
+void schedule_task_running(struct task *task)
+{
+	/* deadline will change if task queues itself for next run */
+	task->run_deadline = task->deadline;
+	task->run_start = platform_timer_get(platform_timer);
+}
+
+/* peak run time decays by 1/2^PEAK_RTIME_DECAY of itself every run */
+#define PEAK_RTIME_DECAY	4
+
+/*
+ * Update task runtime statistics, returns non zero if the peak run time used
+ * for the EDF key has changed. Run time is the wall clock time from start to
+ * completion, so it includes any preemption by higher priority tasks. This is
+ * intended as it's the time the task really needs to meet its deadline under
+ * the current load. The all time max is kept for reporting only, the EDF key
+ * uses a decaying peak so a single outlier does not shift it forever.
+ */
+static int schedule_task_rtime(struct task *task, uint64_t finish)
+{
+	uint64_t rtime = finish - task->run_start;
+	uint64_t peak;
+
+	task->last_rtime = rtime;
+	task->run_count++;
+
+	/* running average over the last 8 or so runs */
+	if (task->avg_rtime)
+		task->avg_rtime = (task->avg_rtime * 7 + rtime) >> 3;
+	else
+		task->avg_rtime = rtime;
+
+	if (finish > task->run_deadline) {
+		trace_pipe("dl!");
+		task->missed++;
+	}
+
+	if (rtime > task->max_rtime)
+		task->max_rtime = rtime;
+
+	peak = task->peak_rtime - (task->peak_rtime >> PEAK_RTIME_DECAY);
+	if (rtime > peak)
+		peak = rtime;
+
+	if (peak == task->peak_rtime)
+		return 0;
+
+	task->peak_rtime = peak;
+	return 1;
+}
+
+/* Task has completed running - it's already removed from the queue */
 void schedule_task_complete(struct task *task)
 {
+	struct schedule_data *sch = sch_get(task->core);
+	uint64_t finish = platform_timer_get(platform_timer);
 	uint32_t flags;
+	int next = 0;
 
 	tracev_pipe("com");
 
 	spin_lock_irq(&sch->lock, flags);
-	list_item_del(&task->list);
-	task->state = TASK_STATE_COMPLETED;
+
+	switch (task->state) {
+	case TASK_STATE_RUNNING:
+		schedule_task_rtime(task, finish);
+
+		/* periodic tasks are queued for their next period */
+		if (task->period) {
+			task->start += task->period;
+			task->deadline = task->start + task->period_deadline;
+			edf_insert(sch, task);
+			task->state = TASK_STATE_QUEUED;
+			next = 1;
+		} else
+			task->state = TASK_STATE_COMPLETED;
+		break;
+	case TASK_STATE_QUEUED:
+		/* task was queued again while running */
+		if (schedule_task_rtime(task, finish)) {
+			/* effective deadline has changed so re-queue */
+			list_item_del(&task->list);
+			edf_insert(sch, task);
+		}
+		break;
+	case TASK_STATE_CANCEL:
+		/* task was deleted while running */
+		schedule_task_rtime(task, finish);
+		task->state = TASK_STATE_COMPLETED;
+		break;
+	default:
+		schedule_task_rtime(task, finish);
+		break;
+	}
+
 	spin_unlock_irq(&sch->lock, flags);
+
+	/* rerun scheduler for next period */
+	if (next)
+		schedule_core(task->core);
 }
 
 void scheduler_run(void *unused)
 {
+	struct schedule_data *sch = sch_get(cpu_get_id());
 	struct task *next_task;
+	uint32_t flags;
 
 	tracev_pipe("run");
 
-	/* EDF is only scheduler supported atm */
-	next_task = schedule_edf();
+	spin_lock_irq(&sch->lock, flags);
+	sch->running = 1;
+	spin_unlock_irq(&sch->lock, flags);
+
+	/* EDF is only scheduler supported atm, run again for any requests
+	 * made while running */
+	for (;;) {
+		next_task = schedule_edf();
+
+		spin_lock_irq(&sch->lock, flags);
+		if (!sch->rerun) {
+			sch->running = 0;
+			spin_unlock_irq(&sch->lock, flags);
+			break;
+		}
+		sch->rerun = 0;
+		spin_unlock_irq(&sch->lock, flags);
+	}
+
 	if (next_task) {
 		work_reschedule_default_at(&sch->work, next_task->start);
 	}
@@ -298,25 +597,132 @@ void schedule(void)
 {
 	tracev_pipe("sch");
 
-	/* TODO: detect current IRQ context and call scheduler_run if both
-	 * current context matches scheduler context. saves a DSP context
-	 * switch.
-	 */
-
 	/* the scheduler is run in IRQ context */
-	interrupt_set(PLATFORM_SCHEDULE_IRQ);
+	schedule_core(cpu_get_id());
+}
+
+/*
+ * Batch schedule requests on this core. Used by IRQ handlers that can
+ * schedule many tasks in one pass, e.g. DMA completion for several channels.
+ * The scheduler is run once by schedule_batch_end() if any task was scheduled.
+ */
+void schedule_batch_begin(void)
+{
+	struct schedule_data *sch = sch_get(cpu_get_id());
+	uint32_t flags;
+
+	spin_lock_irq(&sch->lock, flags);
+	sch->batch++;
+	spin_unlock_irq(&sch->lock, flags);
 }
 
-/* Initialise the scheduler */
+void schedule_batch_end(void)
+{
+	struct schedule_data *sch = sch_get(cpu_get_id());
+	uint32_t pending = 0;
+	uint32_t flags;
+
+	spin_lock_irq(&sch->lock, flags);
+
+	/* run scheduler if this is the outer batch */
+	if (--sch->batch == 0 && sch->batch_pending) {
+		pending = sch->batch_pending;
+		sch->batch_pending = 0;
+		sch->batch_count++;
+		sch->batch_coalesced += pending - 1;
+	}
+
+	spin_unlock_irq(&sch->lock, flags);
+
+	if (pending) {
+		tracev_pipe("bat");
+		tracev_value(pending);
+		schedule_local();
+	}
+}
+
+/* get batching statistics for core, returns -EINVAL if no scheduler */
+int schedule_batch_stats(int core, uint32_t *batches, uint32_t *coalesced)
+{
+	struct schedule_data *sch = sch_get(core);
+	uint32_t flags;
+
+	if (sch == NULL)
+		return -EINVAL;
+
+	spin_lock_irq(&sch->lock, flags);
+	*batches = sch->batch_count;
+	*coalesced = sch->batch_coalesced;
+	spin_unlock_irq(&sch->lock, flags);
+
+	return 0;
+}
+
+/* get core load budget in kcps */
+static inline uint32_t sch_load_max(void)
+{
+	return clock_get_freq(CLK_CPU) / 1000 * PLATFORM_MCPS_LOAD / 100;
+}
+
+/*
+ * Replace old_kcps of reserved core load with new_kcps. Returns -EBUSY if the
+ * core does not have enough MCPS left for the new load.
+ */
+int schedule_load_update(int core, uint32_t old_kcps, uint32_t new_kcps)
+{
+	struct schedule_data *sch = sch_get(core);
+	uint32_t flags;
+	uint32_t load;
+	int ret = 0;
+
+	if (sch == NULL)
+		return -EINVAL;
+
+	spin_lock_irq(&sch->lock, flags);
+
+	load = sch->load - old_kcps + new_kcps;
+	if (new_kcps > old_kcps && load > sch_load_max()) {
+		trace_pipe_error("eLd");
+		trace_value(load);
+		ret = -EBUSY;
+		goto out;
+	}
+
+	sch->load = load;
+
+out:
+	spin_unlock_irq(&sch->lock, flags);
+	return ret;
+}
+
+/* get free core load in kcps */
+uint32_t schedule_load_free(int core)
+{
+	struct schedule_data *sch = sch_get(core);
+	uint32_t max = sch_load_max();
+
+	if (sch == NULL || sch->load >= max)
+		return 0;
+
+	return max - sch->load;
+}
+
+/* Initialise the scheduler - called on each core that runs tasks */
 int scheduler_init(struct reef *reef)
 {
+	struct schedule_data *sch;
+	int core = cpu_get_id();
+
 	trace_pipe("ScI");
+	trace_value(core);
 
 	sch = rzalloc(RZONE_SYS, RFLAGS_NONE, sizeof(*sch));
 	list_init(&sch->list);
 	spinlock_init(&sch->lock);
 	sch->clock = PLATFORM_SCHED_CLOCK;
+	sch->core = core;
 	work_init(&sch->work, sch_work, sch, WORK_ASYNC);
+	sch_core[core] = sch;
 
 	/* configure scheduler interrupt */
 	interrupt_register(PLATFORM_SCHEDULE_IRQ, scheduler_run, NULL);
@@ -38,6 +38,7 @@
 #include <reef/lock.h>
 #include <reef/notifier.h>
 #include <reef/debug.h>
+#include <reef/trace.h>
 #include <platform/clk.h>
 #include <platform/platform.h>
 
@@ -58,10 +59,20 @@
  * frequency changes.
  */
 
+/* min time from now the queue timer can be set to */
+#define WORK_MIN_TIMEOUT_US	2
+
+#define trace_work_error(__e)	trace_error(TRACE_CLASS_WAIT, __e)
+
+/*
+ * Queued work is kept in a binary min heap ordered by timeout, so the next
+ * work to run is always heap[0]. Each work item knows its heap index, so
+ * schedule, reschedule and cancel are O(log n) and do not search the queue.
+ */
 struct work_queue {
-	struct list_item work;		/* list of work */
+	struct work **heap;		/* queued work, ordered by timeout */
+	uint32_t count;			/* work items in heap */
 	uint64_t timeout;		/* timeout for next queue run */
-	uint32_t window_size;		/* window size for pending work */
 	spinlock_t lock;
 	struct notifier notifier;	/* notify CPU freq changes */
 	struct work_queue_timesource *ts;	/* time source for work queue */
@@ -93,180 +104,214 @@ static inline uint64_t work_get_timer(struct work_queue *queue)
 	return queue->ts->timer_get(&queue->ts->timer);
 }
 
-/* is there any work pending in the current time window ? */
-static int is_work_pending(struct work_queue *queue)
+/* is timeout a before timeout b */
+static inline int work_before(uint64_t a, uint64_t b)
 {
-	struct list_item *wlist;
-	struct work *work;
-	uint32_t win_end, win_start;
-	int pending_count = 0;
-
-	/* get the current valid window of work */
-	win_end = work_get_timer(queue);
-	win_start = win_end - queue->window_size;
+	return a < b;
+}
 
-	/* correct the pending flag window for overflow */
-	if (win_end > win_start) {
+/* ticks between a and b in usecs, saturating at 32 bits */
+static inline uint32_t work_delta_usecs(uint64_t a, uint64_t b,
+	uint32_t ticks_per_usec)
+{
+	uint64_t delta = a > b ? a - b : 0;
 
-		/* mark each valid work item in this time period as pending */
-		list_for_item(wlist, &queue->work) {
+	if (delta > 0xffffffff)
+		delta = 0xffffffff;
 
-			work = container_of(wlist, struct work, list);
+	return (uint32_t)delta / ticks_per_usec;
+}
 
-			/* if work has timed out then mark it as pending to run */
-			if (work->timeout >= win_start && work->timeout <= win_end) {
-				work->pending = 1;
-				pending_count++;
-			} else {
-				work->pending = 0;
-			}
-		}
-	} else {
+static inline void heap_set(struct work_queue *queue, uint32_t index,
+	struct work *work)
+{
+	queue->heap[index] = work;
+	work->index = index;
+}
 
-		/* mark each valid work item in this time period as pending */
-		list_for_item(wlist, &queue->work) {
+/* move work towards the heap root until its parent runs before it */
+static void heap_up(struct work_queue *queue, uint32_t index)
+{
+	struct work *work = queue->heap[index];
+	uint32_t parent;
 
-			work = container_of(wlist, struct work, list);
+	while (index > 0) {
+		parent = (index - 1) >> 1;
+		if (!work_before(work->timeout, queue->heap[parent]->timeout))
+			break;
 
-			/* if work has timed out then mark it as pending to run */
-			if (work->timeout <= win_end ||
-				(work->timeout >= win_start && work->timeout < MAX_INT)) {
-				work->pending = 1;
-				pending_count++;
-			} else {
-				work->pending = 0;
-			}
-		}
+		heap_set(queue, index, queue->heap[parent]);
+		index = parent;
 	}
 
-	return pending_count;
+	heap_set(queue, index, work);
 }
 
-static inline void work_next_timeout(struct work_queue *queue,
-	struct work *work, uint32_t reschedule_usecs)
+/* move work away from the heap root until its children run after it */
+static void heap_down(struct work_queue *queue, uint32_t index)
 {
-	/* reschedule work */
-	if (work->flags & WORK_SYNC) {
-		work->timeout += queue->ticks_per_usec * reschedule_usecs;
-	} else {
-		/* calc next run based on work request */
-		work->timeout = queue->ticks_per_usec *
-			reschedule_usecs + queue->run_ticks;
+	struct work *work = queue->heap[index];
+	uint32_t child;
+
+	while (1) {
+		child = (index << 1) + 1;
+		if (child >= queue->count)
+			break;
+
+		/* pick the earlier child */
+		if (child + 1 < queue->count &&
+			work_before(queue->heap[child + 1]->timeout,
+			queue->heap[child]->timeout))
+			child++;
+
+		if (!work_before(queue->heap[child]->timeout, work->timeout))
+			break;
+
+		heap_set(queue, index, queue->heap[child]);
+		index = child;
 	}
+
+	heap_set(queue, index, work);
 }
 
-/* run all pending work */
-static void run_work(struct work_queue *queue, uint32_t *flags)
+/* add work to queue, the queue is sized so it never overflows */
+static void queue_add(struct work_queue *queue, struct work *work)
 {
-	struct list_item *wlist, *tlist;
-	struct work *work;
-	uint32_t reschedule_usecs, udelay;
-
-	/* check each work item in queue for pending */
-	list_for_item_safe(wlist, tlist, &queue->work) {
-
-		work = container_of(wlist, struct work, list);
+	if (queue->count == PLATFORM_WORKQ_SIZE) {
+		trace_work_error("eWf");
+		panic(PANIC_WORK);
+	}
 
-		/* run work if its pending and remove from the queue */
-		if (work->pending) {
+	work->queued = 1;
+	heap_set(queue, queue->count++, work);
+	heap_up(queue, work->index);
+}
 
-			udelay = (work_get_timer(queue) - work->timeout) /
-				queue->ticks_per_usec;
+/* remove work from queue */
+static void queue_del(struct work_queue *queue, struct work *work)
+{
+	struct work *last;
+	uint32_t index = work->index;
 
-			/* work can run in non atomic context */
-			spin_unlock_irq(&queue->lock, *flags);
-			reschedule_usecs = work->cb(work->cb_data, udelay);
-			spin_lock_irq(&queue->lock, *flags);
+	work->queued = 0;
 
-			/* do we need reschedule this work ? */
-			if (reschedule_usecs == 0)
-				list_item_del(&work->list);
-			else {
-				/* get next work timeout */
-				work_next_timeout(queue, work, reschedule_usecs);
-			}
-		}
+	/* move last work into the hole and restore heap order */
+	if (index != --queue->count) {
+		last = queue->heap[queue->count];
+		heap_set(queue, index, last);
+		heap_up(queue, index);
+		heap_down(queue, last->index);
 	}
 }
 
-static inline uint32_t calc_delta_ticks(uint32_t current, uint32_t work)
+/* work timeout has changed, restore heap order */
+static inline void queue_update(struct work_queue *queue, struct work *work)
 {
-	uint32_t max = MAX_INT;
+	heap_up(queue, work->index);
+	heap_down(queue, work->index);
+}
 
-	/* does work run in next cycle ? */
-	if (work < current) {
-		max -= current;
-		max += work;
-		return max;
-	} else
-		return work - current;
+static inline void work_next_timeout(struct work_queue *queue,
+	struct work *work, uint32_t reschedule_usecs)
+{
+	/* reschedule work */
+	if (work->flags & WORK_SYNC) {
+		work->timeout += (uint64_t)queue->ticks_per_usec *
+			reschedule_usecs;
+	} else {
+		/* calc next run based on work request */
+		work->timeout = (uint64_t)queue->ticks_per_usec *
+			reschedule_usecs + queue->run_ticks;
+	}
 }
 
-/* calculate next timeout */
-static void queue_get_next_timeout(struct work_queue *queue)
+/* run all work that has timed out */
+static void run_work(struct work_queue *queue, uint32_t *flags)
 {
-	struct list_item *wlist;
 	struct work *work;
-	uint32_t delta = MAX_INT, current, d, ticks;
+	uint32_t reschedule_usecs, udelay;
+	uint64_t current;
 
-	/* only recalc if work list not empty */
-	if (list_is_empty(&queue->work)) {
-		queue->timeout = 0;
-		return;
-	}
+	while (queue->count > 0) {
 
-	ticks = current = work_get_timer(queue);
+		/* is the earliest work due yet ? */
+		work = queue->heap[0];
+		current = work_get_timer(queue);
+		if (work_before(current, work->timeout))
+			break;
 
-	/* find time for next work */
-	list_for_item(wlist, &queue->work) {
+		udelay = work_delta_usecs(current, work->timeout,
+			queue->ticks_per_usec);
 
-		work = container_of(wlist, struct work, list);
+		/* work is dequeued while it runs, so it can be rescheduled or
+		 * cancelled by its callback or another context */
+		queue_del(queue, work);
 
-		d = calc_delta_ticks(current, work->timeout);
+		/* work can run in non atomic context */
+		spin_unlock_irq(&queue->lock, *flags);
+		reschedule_usecs = work->cb(work->cb_data, udelay);
+		spin_lock_irq(&queue->lock, *flags);
 
-		/* is work next ? */
-		if (d < delta) {
-			ticks = work->timeout;
-			delta = d;
+		/* do we need reschedule this work ? */
+		if (reschedule_usecs != 0 && !work->queued) {
+			/* get next work timeout */
+			work_next_timeout(queue, work, reschedule_usecs);
+			queue_add(queue, work);
 		}
 	}
-
-	queue->timeout = ticks;
 }
 
 /* re calculate timers for queue after CPU frequency change */
 static void queue_recalc_timers(struct work_queue *queue,
 	struct clock_notify_data *clk_data)
 {
-	struct list_item *wlist;
 	struct work *work;
-	uint32_t delta_ticks, delta_usecs, current;
+	uint32_t delta_usecs;
+	uint64_t current;
+	int i;
 
 	/* get current time */
 	current = work_get_timer(queue);
 
 	/* re calculate timers for each work item */
-	list_for_item(wlist, &queue->work) {
+	for (i = 0; i < queue->count; i++) {
 
-		work = container_of(wlist, struct work, list);
+		work = queue->heap[i];
 
-		delta_ticks = calc_delta_ticks(current, work->timeout);
-		delta_usecs = delta_ticks / clk_data->old_ticks_per_usec;
+		delta_usecs = work_delta_usecs(work->timeout, current,
+			clk_data->old_ticks_per_usec);
 
 		/* is work within next msec, then schedule it now */
 		if (delta_usecs > 0)
-			work->timeout = current + queue->ticks_per_usec * delta_usecs;
+			work->timeout = current +
+				(uint64_t)queue->ticks_per_usec * delta_usecs;
 		else
 			work->timeout = current + (queue->ticks_per_usec >> 3);
 	}
+
+	/* rounding can reorder close timeouts, so rebuild the heap */
+	for (i = (int)(queue->count >> 1) - 1; i >= 0; i--)
+		heap_down(queue, i);
 }
 
 static void queue_reschedule(struct work_queue *queue)
 {
-	queue_get_next_timeout(queue);
+	uint64_t min;
+
+	/* next timeout is the earliest work */
+	if (queue->count > 0) {
+		queue->timeout = queue->heap[0]->timeout;
+
+		/* the timer only fires on an exact match, so a timeout that
+		 * has passed would fire a full timer wrap late */
+		min = work_get_timer(queue) +
+			queue->ticks_per_usec * WORK_MIN_TIMEOUT_US;
+		if (queue->timeout < min)
+			queue->timeout = min;
 
-	if (queue->timeout)
 		work_set_timer(queue, queue->timeout);
+	} else
+		queue->timeout = 0;
 }
 
 /* run the work queue */
@@ -282,11 +327,10 @@ static void queue_run(void *data)
 
 	queue->run_ticks = work_get_timer(queue);
 
-	/* work can take variable time to complete so we re-check the
-	  queue after running all the pending work to make sure no new work
+	/* work can take variable time to complete so run_work() re-checks
+	  the queue after running each work to make sure no new work
 	  is pending */
-	while (is_work_pending(queue))
-		run_work(queue, &flags);
+	run_work(queue, &flags);
 
 	/* re-calc timer and re-arm */
 	queue_reschedule(queue);
@@ -310,8 +354,6 @@ static void work_notify(int message, void *data, void *event_data)
 		/* CPU frequency update complete */
 		/* scale the window size to clock speed */
 		queue->ticks_per_usec = clock_us_to_ticks(queue->ts->clk, 1);
-		queue->window_size =
-			queue->ticks_per_usec * PLATFORM_WORKQ_WINDOW;
 		queue_recalc_timers(queue, clk_data);
 		queue_reschedule(queue);
 	} else if (message == CLOCK_NOTIFY_PRE) {
@@ -323,26 +365,19 @@ static void work_notify(int message, void *data, void *event_data)
 
 void work_schedule(struct work_queue *queue, struct work *w, uint64_t timeout)
 {
-	struct work *work;
-	struct list_item *wlist;
 	uint32_t flags;
 
 	spin_lock_irq(&queue->lock, flags);
 
-	/* check to see if we are already scheduled ? */
-	list_for_item(wlist, &queue->work) {
-		work = container_of(wlist, struct work, list);
-
-		/* keep original timeout */
-		if (work == w)
-			goto out;
-	}
+	/* keep original timeout if we are already scheduled */
+	if (w->queued)
+		goto out;
 
 	/* convert timeout micro seconds to CPU clock ticks */
 	w->timeout = queue->ticks_per_usec * timeout + work_get_timer(queue);
 
-	/* insert work into list */
-	list_item_prepend(&w->list, &queue->work);
+	/* insert work into queue */
+	queue_add(queue, w);
 
 	/* re-calc timer and re-arm */
 	queue_reschedule(queue);
@@ -358,27 +393,19 @@ void work_schedule_default(struct work *w, uint64_t timeout)
 
 static void reschedule(struct work_queue *queue, struct work *w, uint64_t time)
 {
-	struct work *work;
-	struct list_item *wlist;
 	uint32_t flags;
 
 	spin_lock_irq(&queue->lock, flags);
 
-	/* check to see if we are already scheduled ? */
-	list_for_item(wlist, &queue->work) {
-		work = container_of(wlist, struct work, list);
-
-		/* found it */
-		if (work == w)
-			goto found;
-	}
+	w->timeout = time;
 
-	/* not found insert work into list */
-	list_item_prepend(&w->list, &queue->work);
+	/* move work if already queued, otherwise insert it */
+	if (w->queued)
+		queue_update(queue, w);
+	else
+		queue_add(queue, w);
 
-found:
 	/* re-calc timer and re-arm */
-	w->timeout = time;
 	queue_reschedule(queue);
 
 	spin_unlock_irq(&queue->lock, flags);
@@ -415,11 +442,13 @@ void work_cancel(struct work_queue *queue, struct work *w)
 
 	spin_lock_irq(&queue->lock, flags);
 
-	/* remove work from list */
-	list_item_del(&w->list);
+	/* remove work from queue */
+	if (w->queued) {
+		queue_del(queue, w);
 
-	/* re-calc timer and re-arm */
-	queue_reschedule(queue);
+		/* re-calc timer and re-arm */
+		queue_reschedule(queue);
+	}
 
 	spin_unlock_irq(&queue->lock, flags);
 }
@@ -434,13 +463,13 @@ struct work_queue *work_new_queue(struct work_queue_timesource *ts)
 	struct work_queue *queue;
 
 	/* init work queue */
-	queue = rmalloc(RZONE_SYS, RFLAGS_NONE, sizeof(*queue_));
+	queue = rzalloc(RZONE_SYS, RFLAGS_NONE, sizeof(*queue_));
+	queue->heap = rzalloc(RZONE_SYS, RFLAGS_NONE,
+		sizeof(struct work *) * PLATFORM_WORKQ_SIZE);
 
-	list_init(&queue->work);
 	spinlock_init(&queue->lock);
 	queue->ts = ts;
 	queue->ticks_per_usec = clock_us_to_ticks(queue->ts->clk, 1);
-	queue->window_size = queue->ticks_per_usec * PLATFORM_WORKQ_WINDOW;
 
 	/* notification of clk changes */
 	queue->notifier.cb = work_notify;
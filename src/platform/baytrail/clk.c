@@ -230,6 +230,11 @@ uint64_t clock_us_to_ticks(int clock, uint64_t us)
 	return clk_pdata->clk[clock].ticks_per_usec * us;
 }
 
+uint64_t clock_ticks_to_us(int clock, uint64_t ticks)
+{
+	return ticks / clk_pdata->clk[clock].ticks_per_usec;
+}
+
 uint32_t clock_time_elapsed(int clock, uint32_t previous, uint32_t *current)
 {
 	uint32_t _current;
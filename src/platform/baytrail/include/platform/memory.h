@@ -121,12 +121,19 @@
 	HEAP_RT_COUNT128 * 128 + HEAP_RT_COUNT256 * 256 + \
 	HEAP_RT_COUNT512 * 512 + HEAP_RT_COUNT1024 * 1024)
 
-#define HEAP_BUFFER_BASE		(HEAP_RUNTIME_BASE + HEAP_RUNTIME_SIZE)
-#define HEAP_BUFFER_SIZE	\
-    (DRAM0_SIZE - HEAP_RUNTIME_SIZE - REEF_STACK_SIZE - HEAP_SYSTEM_SIZE)
+/* Heap section sizes for buffer pool - sizes must be cache line aligned */
+#define HEAP_BUF_BLOCK_SIZE0		0x180
+#define HEAP_BUF_COUNT0			50
+#define HEAP_BUF_BLOCK_SIZE1		0x600
+#define HEAP_BUF_COUNT1			16
+#define HEAP_BUF_BLOCK_SIZE2		0x1000
+#define HEAP_BUF_COUNT2			10
 
-#define HEAP_BUFFER_BLOCK_SIZE		0x180
-#define HEAP_BUFFER_COUNT	(HEAP_BUFFER_SIZE / HEAP_BUFFER_BLOCK_SIZE)
+#define HEAP_BUFFER_BASE		(HEAP_RUNTIME_BASE + HEAP_RUNTIME_SIZE)
+#define HEAP_BUFFER_SIZE \
+	(HEAP_BUF_BLOCK_SIZE0 * HEAP_BUF_COUNT0 + \
+	HEAP_BUF_BLOCK_SIZE1 * HEAP_BUF_COUNT1 + \
+	HEAP_BUF_BLOCK_SIZE2 * HEAP_BUF_COUNT2)
 
 /* DMA buffer heap is the same physical memory as buffer heap on baytrail */
 #define HEAP_DMA_BUFFER_BASE		0
@@ -45,6 +45,9 @@ struct reef;
 #define HOST_PAGE_SIZE		4096
 #define PLATFORM_PAGE_TABLE_SIZE	256
 
+/* number of DSP cores */
+#define PLATFORM_CORE_COUNT	1
+
 /* pipeline IRQ */
 #define PLATFORM_SCHEDULE_IRQ	IRQ_NUM_SOFTWARE5
 
@@ -54,6 +57,21 @@ struct reef;
 
 #define PLATFORM_SCHEDULE_COST	200
 
+/*
+ * Max work items queued on a work queue. Each work item is only ever queued
+ * once, and the only items are the scheduler work of each core, DMA trace and
+ * one completion timeout for each nested wait, so this has plenty of headroom.
+ */
+#define PLATFORM_WORKQ_SIZE	16
+
+/* max percentage of core MCPS that can be used by pipelines */
+#define PLATFORM_MCPS_LOAD	90
+
+/* DSP cycles per sample multiply accumulate in the C audio kernels, including
+ * loads and stores. Components scale this by their configured work per frame
+ * to estimate their load */
+#define PLATFORM_MAC_COST	2
+
 /* maximum preload pipeline depth */
 #define MAX_PRELOAD_SIZE	20
 
@@ -73,9 +91,6 @@ struct reef;
 /* DMA host transfer timeouts in microseconds */
 #define PLATFORM_HOST_DMA_TIMEOUT	50
 
-/* WorkQ window size in microseconds */
-#define PLATFORM_WORKQ_WINDOW	2000
-
 /* local buffer size of DMA tracing */
 #define DMA_TRACE_LOCAL_SIZE	HOST_PAGE_SIZE
 
@@ -99,4 +114,7 @@ int platform_boot_complete(uint32_t boot_message);
 
 int platform_init(struct reef *reef);
 
+/* ask core to run its scheduler, used when queueing a task on another core */
+void platform_idc_schedule(int core);
+
 #endif
@@ -39,6 +39,7 @@
 #include <uapi/ipc.h>
 #include <reef/mailbox.h>
 #include <reef/dai.h>
+#include <reef/debug.h>
 #include <reef/dma.h>
 #include <reef/reef.h>
 #include <reef/work.h>
@@ -104,6 +105,12 @@ int platform_boot_complete(uint32_t boot_message)
 	return 0;
 }
 
+/* Baytrail has a single core so there is no other core to send IDC to */
+void platform_idc_schedule(int core)
+{
+	panic(PANIC_PLATFORM);
+}
+
 /* clear mask in PISR, bits are W1C in docs but some bits need preserved ?? */
 void platform_interrupt_clear(uint32_t irq, uint32_t mask)
 {